@@ -0,0 +1,239 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "avr_compiler.h"
+#include "hal/hal.h"
+#include "analog.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Analog inputs
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* ADC pin for analog 1..6: PA3, PB0, PA1, PB1, PA0, PB3 */
+static const uint8_t analog_pins[ANALOG_CHANNELS] = { 3, 8, 1, 9, 0, 11 };
+
+static uint16_t analog_samples[2][ANALOG_CHANNELS];
+static volatile uint8_t analog_front;   /* the half readers use */
+static volatile uint16_t analog_count;  /* completed sweeps */
+static uint8_t analog_oversample[ANALOG_CHANNELS];
+
+/* where the sweep is */
+static uint8_t analog_chan;
+static uint8_t analog_done;
+static uint16_t analog_sum;
+static uint8_t analog_busy;             /* armed or sweeping */
+
+/* current sense: the ADC pins and which motor each is for, in the
+ * order the triggers take turns converting them, the one the next
+ * trigger converts, and whether this period's has been done */
+static uint8_t analog_current_pin[ANALOG_MOTORS];
+static uint8_t analog_current_motor[ANALOG_MOTORS];
+static uint8_t analog_current_input[ANALOG_MOTORS];
+static uint8_t analog_currents;
+static uint8_t analog_turn;
+static uint8_t analog_step;
+
+void analog_init(void)
+{
+    memset(analog_samples, 0, sizeof(analog_samples));
+    memset(analog_oversample, 0, sizeof(analog_oversample));
+    analog_front = 0;
+    analog_count = 0;
+    analog_chan = 0;
+    analog_done = 0;
+    analog_sum = 0;
+    analog_busy = false;
+    memset(analog_current_input, ANALOG_NONE, sizeof(analog_current_input));
+    analog_currents = 0;
+    analog_turn = 0;
+    analog_step = 0;
+    /* the PWM timer starts the first conversion */
+    hal_adc_select(analog_pins[0]);
+}
+
+/* set the mux for whatever the next trigger is going to convert */
+static void analog_wait(void)
+{
+    analog_step = 0;
+    if (analog_currents)
+        hal_adc_select(analog_current_pin[analog_turn]);
+    else
+        hal_adc_select(analog_pins[analog_chan]);
+}
+
+/* Sense a motor's current on an analog input (0-5), or stop with
+ * ANALOG_NONE. Any sweep in progress is dropped. Called with the
+ * control interrupts held off; a conversion already running when
+ * this is called can still come back as the wrong input once. */
+void analog_set_current(uint8_t motor, uint8_t input)
+{
+    uint8_t m;
+
+    if (motor >= ANALOG_MOTORS)
+        return;
+    if (input >= ANALOG_CHANNELS)
+        input = ANALOG_NONE;
+    analog_current_input[motor] = input;
+
+    analog_currents = 0;
+    for (m = 0; m < ANALOG_MOTORS; m++)
+    {
+        if (analog_current_input[m] == ANALOG_NONE)
+            continue;
+        analog_current_pin[analog_currents] = analog_pins[analog_current_input[m]];
+        analog_current_motor[analog_currents] = m;
+        analog_currents++;
+    }
+
+    analog_turn = 0;
+    analog_chan = 0;
+    analog_done = 0;
+    analog_sum = 0;
+    analog_busy = false;
+    if (analog_currents)
+        hal_adc_arm();
+    else
+        hal_adc_disarm();
+    analog_wait();
+}
+
+/* Called from the control tick. Does nothing if the last sweep hasn't
+ * finished, so a sweep that takes longer than the interval just makes
+ * the next one late. While currents are being sensed the trigger is
+ * always armed and the sweep just needs asking for. */
+void analog_start(void)
+{
+    if (analog_busy)
+        return;
+    analog_busy = true;
+    if (!analog_currents)
+        hal_adc_arm();
+}
+
+/* the motor whose current the next trigger converts, or ANALOG_NONE */
+uint8_t analog_current_next(void)
+{
+    return analog_currents ? analog_current_motor[analog_turn] : ANALOG_NONE;
+}
+
+/* Called from the conversion complete interrupt with the result, and
+ * starts the next conversion if there is one. Returns the motor if it
+ * was a current sample, otherwise ANALOG_NONE. An oversample setting
+ * that changes mid-sweep only affects the channel being converted,
+ * which then averages the wrong number of samples once. */
+uint8_t analog_convert(uint16_t result)
+{
+    uint8_t os = analog_oversample[analog_chan];
+    uint8_t motor;
+
+    /* the trigger's conversion, the current it's this motor's turn for */
+    if (analog_currents && analog_step == 0)
+    {
+        motor = analog_current_motor[analog_turn];
+        if (++analog_turn == analog_currents)
+            analog_turn = 0;
+        analog_step = 1;
+        if (analog_busy)
+        {
+            hal_adc_select(analog_pins[analog_chan]);
+            hal_adc_start();
+        }
+        else
+            analog_wait();
+        return motor;
+    }
+
+    /* the first conversion of the sweep: the rest are started from
+     * here, not by the timer */
+    if (!analog_currents && analog_chan == 0 && analog_done == 0)
+        hal_adc_disarm();
+
+    analog_sum += result;
+    if (++analog_done < (1 << os))
+    {
+        /* sensing currents, it's one sweep conversion per trigger */
+        if (analog_currents)
+            analog_wait();
+        else
+            hal_adc_start();
+        return ANALOG_NONE;
+    }
+
+    analog_samples[!analog_front][analog_chan] = analog_sum >> os;
+    analog_sum = 0;
+    analog_done = 0;
+
+    if (++analog_chan < ANALOG_CHANNELS)
+    {
+        if (analog_currents)
+            analog_wait();
+        else
+        {
+            hal_adc_select(analog_pins[analog_chan]);
+            hal_adc_start();
+        }
+        return ANALOG_NONE;
+    }
+
+    /* sweep complete: publish it and wait for the next trigger. The
+     * TWI interrupt can come in between the count's two bytes. */
+    analog_chan = 0;
+    analog_front = !analog_front;
+    {
+        AVR_ENTER_CRITICAL_REGION();
+        analog_count++;
+        AVR_LEAVE_CRITICAL_REGION();
+    }
+    analog_busy = false;
+    analog_wait();
+    return ANALOG_NONE;
+}
+
+/* latest complete sample of analog channel+1, in ADC counts */
+uint16_t analog_read(uint8_t channel)
+{
+    return analog_samples[analog_front][channel];
+}
+
+uint16_t analog_sweeps(void)
+{
+    uint16_t n;
+    AVR_ENTER_CRITICAL_REGION();
+    n = analog_count;
+    AVR_LEAVE_CRITICAL_REGION();
+    return n;
+}
+
+void analog_set_oversample(uint8_t channel, uint8_t oversample)
+{
+    if (channel >= ANALOG_CHANNELS)
+        return;
+    if (oversample > ANALOG_OVERSAMPLE_MAX)
+        oversample = ANALOG_OVERSAMPLE_MAX;
+    analog_oversample[channel] = oversample;
+}
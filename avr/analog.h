@@ -0,0 +1,75 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef ANALOG_H
+#define ANALOG_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* The analog inputs are sampled in sweeps, each started by
+ * analog_start() from the control tick. That only arms the trigger:
+ * the first conversion is started by the PWM timer at a fixed phase
+ * in the next period, so it always lands the same distance from the
+ * switching edge at the start of the period however fast the PWM
+ * runs, and a sweep is never restarted before it's finished. Each
+ * conversion complete interrupt starts the next one, until every
+ * input has been converted 2^oversample times; only the first is
+ * locked to the PWM, the rest follow it back to back. The conversions for an
+ * input are averaged into the back half of a double buffer. When the
+ * sweep is done the halves are swapped with a single byte write.
+ *
+ * A motor's current can be sensed on one of the inputs as well. Then
+ * the trigger is armed all the time and starts a current sense
+ * conversion every PWM period, at the phase the current loop wants,
+ * and the sweep only gets one conversion after it per period. Every
+ * current sample is started by the trigger, so each is locked to the
+ * PWM; with both motors sensed they take turns, a period each, and
+ * analog_current_next() says whose turn the next trigger is. The
+ * current samples aren't averaged or kept; analog_convert() hands
+ * each one straight back to the interrupt for the current loop.
+ *
+ * The conversion interrupt is at the same level as the control tick,
+ * so it can't run in the middle of a tick. Everything the control loop
+ * reads in one tick therefore comes from the same complete sweep. */
+
+#define ANALOG_CHANNELS 6
+#define ANALOG_MOTORS 2
+#define ANALOG_NONE 0xff
+#define ANALOG_OVERSAMPLE_MAX 4 /* log2, so up to 16 conversions */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void analog_init(void);
+void analog_start(void);
+void analog_set_current(uint8_t motor, uint8_t input);
+uint8_t analog_current_next(void);
+uint8_t analog_convert(uint16_t result);
+uint16_t analog_read(uint8_t channel);
+uint16_t analog_sweeps(void);
+void analog_set_oversample(uint8_t channel, uint8_t oversample);
+
+#endif /* ANALOG_H */
@@ -68,10 +68,15 @@
 
 
 
+#ifdef HAL_HOST
+/* host build: see hal/hal.h */
+#include "hal/host_io.h"
+#else
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <util/delay.h>
+#endif
 
 /*! \brief Define the delay_us macro for GCC. */
 #define delay_us( us )   (_delay_us( us ))
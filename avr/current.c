@@ -0,0 +1,89 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "fixed.h"
+#include "current.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Current loop
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void current_init(current_t* c, uint16_t rate, int32_t out_max)
+{
+    c->P = 0;
+    c->I = 0;
+    c->rate = rate;
+    c->target = 0;
+    c->out_max = out_max;
+    current_prepare(c);
+    current_reset(c);
+}
+
+void current_reset(current_t* c)
+{
+    c->integ = 0;
+    c->measured = 0;
+}
+
+/* gains and rate to the update's formats, saturating */
+void current_prepare(current_t* c)
+{
+    int32_t kp = c->P >> 8;
+    int32_t ki = c->I / (c->rate ? c->rate : 1);
+
+    c->kp = (uint16_t)fix_clamp(kp, 0, UINT16_MAX);
+    c->ki = (uint16_t)fix_clamp(ki, 0, UINT16_MAX);
+}
+
+/* whether current_prepare() can take these gains as they are at the
+ * current rate, without clamping either */
+bool current_gains_fit(const current_t* c, fix_t P, fix_t I)
+{
+    return P >= 0 && (P >> 8) <= UINT16_MAX
+        && I >= 0 && I / (c->rate ? c->rate : 1) <= UINT16_MAX;
+}
+
+int32_t current_update(current_t* c, int16_t measured)
+{
+    int32_t lim = c->out_max << 8;
+    int16_t e;
+    int32_t u;
+
+    c->measured = measured;
+    /* both are 13-bit at most, so this can't overflow */
+    e = c->target - measured;
+
+    c->integ += ((int32_t)c->ki * e) >> 8;
+    if (c->integ > lim) c->integ = lim;
+    if (c->integ < -lim) c->integ = -lim;
+
+    u = ((int32_t)c->kp * e + c->integ) >> 8;
+    if (u > c->out_max) u = c->out_max;
+    if (u < -c->out_max) u = -c->out_max;
+    return u;
+}
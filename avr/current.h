@@ -0,0 +1,76 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef CURRENT_H
+#define CURRENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixed.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* The inner current loop: a PI that runs once per PWM period (every
+ * other with both channels' running) from the ADC interrupt, straight after the channel's current sense sample,
+ * and turns a target current into a duty cycle. Currents are in ADC
+ * counts, signed by the way the bridge is driving.
+ *
+ * At 20kHz there's no time for pid_update()'s three 32x16 bit
+ * multiplies and 48-bit sums, so everything in this update is a
+ * 16x16 bit multiply into 32 bits: kp is Q8.8 duty per count and ki is Q0.16 duty per count per
+ * update. They're worked out from the gains as sent over I2C (Q16.16,
+ * per count and per count per second) by current_prepare(), which
+ * runs when a gain or the PWM rate changes, with the control
+ * interrupts held off. The integrator is Q24.8 duty and is clamped to
+ * the output range, which is the anti-windup.
+ *
+ * So P has to be from 0 up to just under 256.0, and I from 0 up to
+ * just under one duty count per ADC count per update, rate per second;
+ * current_gains_fit() says whether a pair does, and the decoder
+ * ignores gains that don't. An I that fitted can stop fitting when a
+ * slower PWM mode lowers the rate; current_prepare() then saturates
+ * it at the most ki can hold. */
+
+typedef struct {
+    fix_t P;                    /* duty per count, Q16.16 */
+    fix_t I;                    /* duty per count per second, Q16.16 */
+    uint16_t rate;              /* updates per second */
+    uint16_t kp;                /* Q8.8 */
+    uint16_t ki;                /* Q0.16, per update */
+    int16_t target;             /* counts */
+    int16_t measured;           /* the last sample */
+    int32_t integ;              /* Q24.8 duty */
+    int32_t out_max;            /* output is within +-this */
+} current_t;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void current_init(current_t* c, uint16_t rate, int32_t out_max);
+void current_reset(current_t* c);
+void current_prepare(current_t* c);
+bool current_gains_fit(const current_t* c, fix_t P, fix_t I);
+int32_t current_update(current_t* c, int16_t measured);
+
+#endif /* CURRENT_H */
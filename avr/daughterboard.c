@@ -22,15 +22,24 @@
 /////////////////////////////////////////////////////////////////////////
 
 #include <inttypes.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
 #include <string.h>
 /* #include <avr/sleep.h> */
 
 #include "avr_compiler.h"
-#include "clksys/clksys_driver.h"
+#include "hal/hal.h"
 #include "twi/twi_slave_driver.h"
-#include "watchdog/wdt_driver.h"
+#include "fixed.h"
+#include "pid.h"
+#include "motion.h"
+#include "path.h"
+#include "output.h"
+#include "current.h"
+#include "regmap.h"
+#include "telemetry.h"
+#include "encoder.h"
+#include "analog.h"
+#include "sched.h"
+#include "profile.h"
 #include "daughterboard.h"
 #include "i2c_commands.h"
 
@@ -39,9 +48,33 @@
 /// Defines
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
-#define SAULDECODE
 
-#define PWM_PERIOD 0xffff
+/* duty cycles are a fraction of 0x10000 whatever the PWM mode */
+#define DUTY_MAX 0xffff
+
+/* the current loops run once per PWM period; clock 0 ticks at 16MHz */
+#define CURRENT_RATE(period) ((uint16_t)(16000000UL / ((period) + 1UL)))
+/* ADC counts */
+#define CURRENT_LIMIT_MAX 4095
+
+/* which stage of a channel bits 5-4 of a gain command's first byte
+ * pick, I2C_STAGE_* */
+#define MOTOR_STAGE(b) (((b) >> 4) & 0x03)
+
+/* what a bridge's input pins are set to */
+#define MOTOR_PINS_FORWARD 0
+#define MOTOR_PINS_REVERSE 1
+#define MOTOR_PINS_BRAKE 2
+
+/* clock 1 runs at 16MHz and overflows every CONTROL_PERIOD ticks */
+#define CONTROL_PERIOD 1600
+#define CONTROL_RATE_HZ 10000
+
+/* the analog sweep starts this many clock 0 ticks (16us) after the
+ * switching edge at the start of a PWM period, in the first period
+ * after the control tick asks for one, every ANALOG_TICKS ticks */
+#define ANALOG_PHASE 0x0100
+#define ANALOG_TICKS 10
 
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
@@ -49,95 +82,389 @@
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
+/////////////////////////////
+// public variables
+led_t* led_power;
+led_t* led_orders;
+led_t* led_error1;
+led_t* led_error2;
+led_t* led_mota;
+led_t* led_motb;
+
+sensorfunc sensor_functions[16];
+
+motor_channel_t motA;
+motor_channel_t motB;
+
 /////////////////////////////
 // private variables
 uint8_t twi_last_read = 0x00;
-uint8_t digital_send_buf[0xff];
-uint8_t digital_send_idx;
-uint8_t digital_send_len;
+TWIS_Frame_t* digital_send_frame; /* received frame being shown, or 0 */
+uint16_t digital_send_idx;
+encoder_t encA;
+encoder_t encB;
+
+/* Clock 0's period in each PWM mode; it counts at 16MHz. The duty is
+ * written from the 10kHz control tick, so at 20kHz it changes every
+ * other period. Updating it from the overflow as well would take an
+ * interrupt every 50us for nothing but the sub-step dither, since the
+ * command it comes from only changes once a tick; the current loop,
+ * which does have a new value every period, drives the bridge from the
+ * ADC interrupt instead. */
+static const uint16_t pwm_periods[I2C_PWM_MODES] = {
+    [I2C_PWM_MODE_LEGACY] = 0xffff,     /* 244Hz */
+    [I2C_PWM_MODE_8KHZ] = 1999,
+    [I2C_PWM_MODE_20KHZ] = 799,
+};
+uint16_t pwm_period;
+uint8_t analog_ticks;
+
+/* published by the control tick, see motor_snap_t */
+motor_snap_t motor_snaps[2][2];
+volatile uint8_t motor_snap_idx;
+volatile uint8_t motor_snap_seq;
 
 /////////////////////////////
 // private functions
 uint8_t led_check_value(led_t*);
 void init_digout(void);
-void do_digout(void);
+uint8_t* TWIC_Reply(void);
+void TWIC_Publish(uint8_t);
+void TWIC_Process(void);
 void TWIC_Decode(void);
+void TWIC_ReplyProfile(uint8_t, uint8_t);
+void TWIC_SetMoveLimit(motion_t*, uint8_t, int32_t);
+void TWIC_ReplyMotion(motor_channel_t*);
+void TWIC_PushWaypoint(void);
+void TWIC_ReplyPath(motor_channel_t*);
+void TWIC_Registers(void);
+static void motor_current(motor_channel_t*, uint16_t);
+static void motor_current_phase(void);
+static void motor_drive(motor_channel_t*);
+int32_t sensor_encoder_a(void);
+int32_t sensor_encoder_b(void);
+int32_t sensor_encoder_a_velocity(void);
+int32_t sensor_encoder_b_velocity(void);
+int32_t sensor_analog_1(void);
+int32_t sensor_analog_2(void);
+int32_t sensor_analog_3(void);
+int32_t sensor_analog_4(void);
+int32_t sensor_analog_5(void);
+int32_t sensor_analog_6(void);
 register8_t* TWIC_waitForData(int);
+
+/* Rate groups. The control group runs in the clock 1 interrupt; the
+ * rest are run from the main loop by deadline. Periods are in control
+ * ticks. */
+rategroup_t sched_groups[SCHED_GROUP_COUNT] = {
+    [SCHED_GROUP_CONTROL] =
+    { 1,                        0, 0, {do_sensors, do_motors} },
+    [SCHED_GROUP_SUPERVISE] =
+    { CONTROL_RATE_HZ / 1000,   0, 0, {do_digout, do_stage, regmap_refresh} },
+    [SCHED_GROUP_HOUSEKEEPING] =
+    { CONTROL_RATE_HZ / 100,    0, 0, {do_leds, do_address} },
+};
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 /// TWI
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
-#define SLAVE_ADDRESS 0x55
+#define SLAVE_ADDRESS 0x55      /* until one is assigned */
 #define BAUDRATE 5000
 #define TWI_BAUDSETTING TWI_BAUD(F_CPU, BAUDRATE)
 
 TWI_Slave_t twiSlave;            /* TWI slave module. */
+register8_t* twi_frame;          /* the frame being decoded */
+uint8_t twi_frame_len;
+
+/* replies are built in whichever buffer isn't published, so a read
+ * never sends half of one reply and half of the next */
+uint8_t twi_reply[2][TWIS_SEND_BUFFER_SIZE];
+uint8_t twi_reply_idx;
+
+/* set by the TWI interrupt the moment a latch command comes in, and
+ * acted on by the next control tick */
+volatile uint8_t twi_latch;
+
+/* a latch that came in behind writes the main loop hadn't decoded yet,
+ * and the frame count it waits for, see latch_release() */
+volatile uint8_t twi_latch_held;
+volatile uint8_t twi_latch_frame;
+
+/* the go command's timeout, in control ticks; 0 is none */
+uint16_t go_timeout;
+uint16_t go_left;
+
+/* the exchange command's reply, staged ahead, see do_stage() */
+uint8_t twi_state[2][I2C_CMD_EXCHANGE_REPLY];
+
+/* The assigned address is kept in EEPROM followed by its complement,
+ * so an erased or half-written pair reads as no address. */
+#define EEPROM_TWI_ADDRESS 0
+
+/* our unique ID and then our address, which is what a read at the
+ * enumeration address gets */
+uint8_t twi_id[I2C_ENUMERATE_REPLY];
+
+/* set by the TWI interrupt when we're assigned an address, and
+ * cleared once it's in EEPROM */
+volatile uint8_t twi_assigned;
+
+static bool twi_address_valid(uint8_t address)
+{
+    return address >= 0x08 && address <= 0x77 &&
+        address != I2C_ENUMERATE_ADDRESS;
+}
 
 void init_twi(void)
 {
+    uint8_t address = hal_eeprom_read(EEPROM_TWI_ADDRESS);
+    uint8_t check = hal_eeprom_read(EEPROM_TWI_ADDRESS + 1);
+
     /* /\* make sure our I2C pins are set to input *\/ */
     /* PORTC.DIRCLR = PIN_SDA_2 | PIN_SCL_2; */
 
     /* set the i2c pins to use internal pullup resistors */
-    PORTCFG.MPCMASK = PIN_SDA_2 | PIN_SCL_2;
-    PORTC.PIN0CTRL = (PORTC.PIN0CTRL & ~PORT_OPC_gm) | PORT_OPC_PULLUP_gc;
-    PORTCFG.MPCMASK = 0x00;
-    
-    /* set our callback */
-    TWI_SlaveInitializeDriver(&twiSlave, &TWIC, TWIC_SlaveProcessData);
-
-    /* low-priority interrupt */
-    TWI_SlaveInitializeModule(&twiSlave, SLAVE_ADDRESS, TWI_SLAVE_INTLVL_LO_gc);
+    hal_gpio_pullup(HAL_PORTC, PIN_SDA_2 | PIN_SCL_2);
 
-    /* enable low-priority interrupts */
-    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+    if ((uint8_t)(address ^ check) != 0xff ||
+        !twi_address_valid(address))
+        address = SLAVE_ADDRESS;
+    hal_unique_id(twi_id);
+    twi_id[HAL_UNIQUE_ID_BYTES] = address;
+    
+    /* the driver queues each write in its own frames; the only thing
+     * done per byte is spotting the few commands that act at once.
+     * High-priority interrupt, alone at its level; see hal.h. */
+    hal_twi_slave_init(&twiSlave, address, TWIC_SlaveProcessData, HAL_INTLVL_HI);
+
+    /* latches and address assignment are broadcast to every board at
+     * once */
+    TWI_SlaveGeneralCall(&twiSlave, true);
+    /* and a broadcast latch is taken even with every frame in use, or
+     * one board would miss it while the rest ACK and go */
+    TWI_SlaveSpareCommand(&twiSlave, I2C_CMD_LATCH);
+    TWI_SlavePublish(&twiSlave, twi_reply[0], 0);
+    do_stage();
+    regmap_refresh();
+
+    /* enable high-priority interrupts */
+    hal_irq_enable(HAL_INTLVL_HI);
 }
 
-ISR(TWIC_TWIS_vect)
+ISR(HAL_TWI_vect)
 {
+    PROF_ENTER(PROF_TWI_ISR);
     TWI_SlaveInterruptHandler(&twiSlave);
+    PROF_EXIT(PROF_TWI_ISR);
 }
 
+/* Called from the TWI interrupt for every byte the master writes. A
+ * latch is acted on as soon as its command byte arrives, which is the
+ * same moment on every board on the bus, rather than when the main
+ * loop gets to it. The exception is a latch behind writes still queued
+ * for the main loop, likely the stage it's meant to apply: it's held
+ * until they're decoded. Enumerate and assign are acted on at once
+ * too, so the master can read the enumeration address straight after
+ * either without waiting for every board's main loop to catch up. */
 void TWIC_SlaveProcessData(void)
 {
-    led_orders->behavior = LED_BEHAVIOR_TIMED;
-    led_orders->time = 1250;
-#ifdef SAULDECODE
-    /* flash the LED so the user knows communication is happening */
+    register8_t* data = twiSlave.receivedData;
+    uint8_t n = twiSlave.bytesReceived;
+    uint8_t i;
 
-
-    /* push results out over the digital pins for debug */
-    digital_send_buf[0] = twiSlave.bytesReceived+1;
-    for(int i = 0; i <= twiSlave.bytesReceived; i++)
+    if (n == 0 && data[0] == I2C_CMD_LATCH)
     {
-        digital_send_buf[i+1] = twiSlave.receivedData[i];
+        if (twiSlave.frameTail == twiSlave.frameHead)
+            twi_latch = true;
+        else
+        {
+            /* a second latch before the first is let through is
+             * merged into it */
+            twi_latch_frame = twiSlave.frameHead;
+            twi_latch_held = true;
+        }
     }
-    digital_send_len = twiSlave.bytesReceived+1 + 1;
-    digital_send_idx = 0;
-
-    if(twiSlave.bytesReceived == 0)
+    else if (n == 0 && data[0] == I2C_CMD_ENUMERATE)
+        TWI_SlaveSecondAddress(&twiSlave, I2C_ENUMERATE_ADDRESS,
+                               twi_id, I2C_ENUMERATE_REPLY);
+    else if (n == I2C_CMD_ASSIGN_BYTES - 1 && data[0] == I2C_CMD_ASSIGN &&
+             twi_address_valid(data[n]))
     {
-        /* set motor A duty cycle to whatever it was we got */
-        motA.duty = twiSlave.receivedData[twiSlave.bytesReceived] << 8;
+        for (i = 0; i < HAL_UNIQUE_ID_BYTES; i++)
+            if (data[1 + i] != twi_id[i])
+                return;
+        twi_id[HAL_UNIQUE_ID_BYTES] = data[n];
+        TWI_SlaveAddress(&twiSlave, data[n]);
+        TWI_SlaveSecondAddress(&twiSlave, 0, 0, 0);
+        twi_assigned = true;
     }
-    else
+}
+
+/* Put an assigned address in EEPROM, from the housekeeping group since
+ * it takes a few ms. Only when the master has assigned one, so a board
+ * nobody has set up never writes to it. */
+void do_address(void)
+{
+    uint8_t address;
+
+    if (!twi_assigned)
+        return;
+    twi_assigned = false;
+    address = twi_id[HAL_UNIQUE_ID_BYTES];
+    hal_eeprom_write(EEPROM_TWI_ADDRESS, address);
+    hal_eeprom_write(EEPROM_TWI_ADDRESS + 1, ~address);
+}
+
+/* Let a held latch through once the frames that came in ahead of it
+ * have been decoded and released. */
+static void latch_release(void)
+{
+    PROF_ENTER_CRITICAL_REGION();
+    if (twi_latch_held &&
+        (int8_t)(twiSlave.frameTail - twi_latch_frame) >= 0)
     {
-        /* set motor B duty cycle to whatever it was we got */
-        motB.duty = twiSlave.receivedData[twiSlave.bytesReceived] << 8;
+        twi_latch_held = false;
+        twi_latch = true;
     }
+    PROF_LEAVE_CRITICAL_REGION();
+}
+
+/* Decode the frames that have come in, from the main loop. Each one is
+ * decoded in place in the driver's buffer and applied with the control
+ * interrupts held off, so the control tick sees all of a command or
+ * none of it, never half a target or half a gain. The TWI interrupt
+ * keeps running: the frame is ours until it's released, and the driver
+ * refuses reads until then, since the reply depends on it, so nothing
+ * it does touches what we're changing. */
+void TWIC_Process(void)
+{
+    TWIS_Frame_t* f;
+
+    while ((f = TWI_SlaveFrame(&twiSlave)) != 0)
+    {
+#ifdef SAULDECODE
+        /* a frame stays put while it's on the digital pins, until
+         * do_digout is done with it or a newer one comes in */
+        if (f == digital_send_frame)
+        {
+            if ((uint8_t)(twiSlave.frameHead - twiSlave.frameTail) < 2)
+                break;
+            digital_send_frame = 0;
+            TWI_SlaveFrameRelease(&twiSlave);
+            continue;
+        }
+#endif
+        HAL_ENTER_CONTROL_REGION();
+        twi_frame = f->data;
+        twi_frame_len = f->length;
+
+        /* flash the LED so the user knows communication is happening */
+        led_orders->behavior = LED_BEHAVIOR_TIMED;
+        led_orders->time = 12;
+
+        /* any command shows the master is still there */
+        go_left = go_timeout;
+#ifdef SAULDECODE
+        /* push the frame out over the digital pins for debug */
+        digital_send_frame = f;
+        digital_send_idx = 0;
+
+        /* set motor A duty cycle to the first byte we got and motor B
+         * to the last */
+        motA.cont.target = (int32_t)twi_frame[0] << 8;
+        if (twi_frame_len > 1)
+            motB.cont.target = (int32_t)twi_frame[twi_frame_len - 1] << 8;
+        HAL_LEAVE_CONTROL_REGION();
+        break;
 #else
-    TWIC_Decode();
+        TWIC_Decode();
+        HAL_LEAVE_CONTROL_REGION();
+        TWI_SlaveFrameRelease(&twiSlave);
 #endif
+    }
+    latch_release();
+}
 
+/* one channel's part of the exchange reply */
+static void stage_channel(motor_channel_t* mot, const motor_snap_t* snap,
+                          uint8_t* buf)
+{
+    int64_t v = (int64_t)snap->moved * CONTROL_RATE_HZ / ENCODER_WINDOW;
+
+    write_u32(&buf[0], snap->measured);
+    write_u32(&buf[4], fix_sat(v));
+    write_u16(&buf[8], snap->drive < 0 ? -snap->drive : snap->drive);
+    buf[10] = (snap->drive < 0 ? I2C_EXCHANGE_REVERSE : 0)
+        | (mot->closed ? I2C_EXCHANGE_CLOSED : 0)
+        | (motion_status(&mot->motion) & MOTION_ACTIVE ? I2C_EXCHANGE_MOVING : 0)
+        | (path_status(&mot->path) & PATH_ACTIVE ? I2C_EXCHANGE_PATH : 0);
+}
+
+/* Build the exchange reply from the latest snapshots, in the supervise
+ * group, and stage it so it's ready the moment the master turns the
+ * bus around. It goes in whichever buffer isn't staged; if a read is
+ * still sending from that one, this round is skipped. */
+void do_stage(void)
+{
+    uint8_t* buf = twi_state[twiSlave.stagedData == twi_state[0]];
+    motor_snap_t a, b;
+    bool busy;
+
+    {
+        PROF_ENTER_CRITICAL_REGION();
+        busy = TWI_SlaveSending(&twiSlave, buf);
+        PROF_LEAVE_CRITICAL_REGION();
+    }
+    if (busy)
+        return;
+
+    motor_snapshot(&motA, &a);
+    motor_snapshot(&motB, &b);
+    write_u16(&buf[0], a.tick);
+    stage_channel(&motA, &a, &buf[2]);
+    stage_channel(&motB, &b, &buf[2 + I2C_EXCHANGE_CHANNEL]);
+
+    {
+        PROF_ENTER_CRITICAL_REGION();
+        TWI_SlaveStage(&twiSlave, buf, I2C_CMD_EXCHANGE_REPLY,
+                       I2C_CMD_EXCHANGE);
+        PROF_LEAVE_CRITICAL_REGION();
+    }
+}
+
+/* the buffer the next reply is built in */
+uint8_t* TWIC_Reply(void)
+{
+    return twi_reply[!twi_reply_idx];
+}
+
+/* send the reply built in TWIC_Reply() to reads from now on */
+void TWIC_Publish(uint8_t len)
+{
+    twi_reply_idx = !twi_reply_idx;
+    TWI_SlavePublish(&twiSlave, twi_reply[twi_reply_idx], len);
 }
 
 void TWIC_Decode()
 {
-    int command = twiSlave.receivedData[0];
+    int command = twi_frame[0];
     register8_t* data;
+    uint8_t* reply = TWIC_Reply();
     motor_channel_t* mot;
+    controller_t* c;
+    fix_t f;
+
+    /* reads after a register or telemetry command are streamed one
+     * byte at a time; everything else replies from the published
+     * buffer */
+    if (command == I2C_CMD_REGISTERS)
+        twiSlave.Send_Data = regmap_read;
+    else if (command == I2C_CMD_GET_TELEMETRY)
+        twiSlave.Send_Data = telem_read;
+    else
+        twiSlave.Send_Data = 0;
 
     switch(command)
     {
@@ -148,6 +475,11 @@ void TWIC_Decode()
     case I2C_CMD_PAUSE:
         break;
     case I2C_CMD_GO:
+        data = TWIC_waitForData(I2C_CMD_GO_BYTES);
+        if (data == 0)
+            return;
+        go_timeout = read_u16(&data[1]);
+        go_left = go_timeout;
         break;
         
         //Data in here
@@ -155,31 +487,194 @@ void TWIC_Decode()
         data = TWIC_waitForData(I2C_CMD_SET_MOTOR_SENSOR_CHANNEL_BYTES);
         if (data == 0)
             return;
-        mot = (twiSlave.receivedData[1] & (1<<7)) ? &motB : &motA;
-        mot->closed = !!(twiSlave.receivedData[1] & (1 << 6));
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        motor_set_mode(mot, data[1]);
+        break;
+    case I2C_CMD_SET_ANALOG_OVERSAMPLE:
+        data = TWIC_waitForData(I2C_CMD_SET_ANALOG_OVERSAMPLE_BYTES);
+        if (data == 0)
+            return;
+        analog_set_oversample(data[1] >> 4, data[1] & 0x0f);
+        break;
+    case I2C_CMD_SET_PWM_MODE:
+        data = TWIC_waitForData(I2C_CMD_SET_PWM_MODE_BYTES);
+        if (data == 0)
+            return;
+        motor_set_pwm_mode(data[1]);
+        break;
+    case I2C_CMD_SET_OUTPUT:
+        data = TWIC_waitForData(I2C_CMD_SET_OUTPUT_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        output_configure(&mot->output, read_u16(&data[2]), data[4],
+                         data[1] & 1);
+        break;
+    case I2C_CMD_SET_CASCADE:
+        data = TWIC_waitForData(I2C_CMD_SET_CASCADE_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        motor_set_cascade(mot, data[1] & (I2C_CASCADE_CURRENT|I2C_CASCADE_VELOCITY),
+                          data[2], data[3], data[4], data[5], read_u16(&data[6]));
         break;
     case I2C_CMD_SET_CONTROLLER_TARGET:
         data = TWIC_waitForData(I2C_CMD_SET_CONTROLLER_TARGET_BYTES);
         if (data == 0)
             return;
-        
-        /* TODO: does not follow spec right now */
-        
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        motor_set_target(mot, fix_from_float_bits(read_u32(&data[2]), 0));
         break;
     case I2C_CMD_SET_CONTROLLER_P:
         data = TWIC_waitForData(I2C_CMD_SET_CONTROLLER_P_BYTES);
         if (data == 0)
             return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        if (MOTOR_STAGE(data[1]) == I2C_STAGE_CURRENT)
+        {
+            /* a gain the current loop can't take is ignored */
+            f = fix_from_float_bits(read_u32(&data[2]), FIX_Q16);
+            if (current_gains_fit(&mot->current, f, mot->current.I))
+            {
+                mot->current.P = f;
+                current_prepare(&mot->current);
+            }
+            break;
+        }
+        c = MOTOR_STAGE(data[1]) == I2C_STAGE_VELOCITY ? &mot->vel : &mot->cont;
+        c->P = fix_from_float_bits(read_u32(&data[2]), c->q);
+        c->dirty = true;
         break;
     case I2C_CMD_SET_CONTROLLER_I:
         data = TWIC_waitForData(I2C_CMD_SET_CONTROLLER_I_BYTES);
         if (data == 0)
             return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        if (MOTOR_STAGE(data[1]) == I2C_STAGE_CURRENT)
+        {
+            f = fix_from_float_bits(read_u32(&data[2]), FIX_Q16);
+            if (current_gains_fit(&mot->current, mot->current.P, f))
+            {
+                mot->current.I = f;
+                current_prepare(&mot->current);
+            }
+            break;
+        }
+        c = MOTOR_STAGE(data[1]) == I2C_STAGE_VELOCITY ? &mot->vel : &mot->cont;
+        c->I = fix_from_float_bits(read_u32(&data[2]), c->q);
+        c->dirty = true;
         break;
     case I2C_CMD_SET_CONTROLLER_D: 
         data = TWIC_waitForData(I2C_CMD_SET_CONTROLLER_D_BYTES);
         if (data == 0)
             return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        if (MOTOR_STAGE(data[1]) == I2C_STAGE_CURRENT)
+            break;
+        c = MOTOR_STAGE(data[1]) == I2C_STAGE_VELOCITY ? &mot->vel : &mot->cont;
+        c->D = fix_from_float_bits(read_u32(&data[2]), c->q);
+        c->dirty = true;
+        break;
+    case I2C_CMD_SET_CONTROLLER_FORMAT:
+        data = TWIC_waitForData(I2C_CMD_SET_CONTROLLER_FORMAT_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        c = MOTOR_STAGE(data[1]) == I2C_STAGE_VELOCITY ? &mot->vel : &mot->cont;
+        pid_set_format(c, (data[1] & (1<<6)) ? FIX_Q24 : FIX_Q16);
+        break;
+    case I2C_CMD_SET_COMPACT_SCALE:
+        data = TWIC_waitForData(I2C_CMD_SET_COMPACT_SCALE_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        mot->target_shift = data[2] > 31 ? 31 : data[2];
+        mot->gain_shift = data[3] > 31 ? 31 : data[3];
+        mot->target_base = read_u32(&data[4]);
+        break;
+    case I2C_CMD_SET_COMPACT_TARGET:
+        data = TWIC_waitForData(I2C_CMD_SET_COMPACT_TARGET_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        motor_set_target(mot, motor_compact_target(mot, &data[2]));
+        break;
+    case I2C_CMD_SET_COMPACT_GAINS:
+        data = TWIC_waitForData(I2C_CMD_SET_COMPACT_GAINS_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        mot->cont.P = motor_compact_gain(mot, &data[2]);
+        mot->cont.I = motor_compact_gain(mot, &data[4]);
+        mot->cont.D = motor_compact_gain(mot, &data[6]);
+        mot->cont.dirty = true;
+        break;
+    case I2C_CMD_SET_COMPACT_TARGETS:
+        data = TWIC_waitForData(I2C_CMD_SET_COMPACT_TARGETS_BYTES);
+        if (data == 0)
+            return;
+        motor_set_target(&motA, motor_compact_target(&motA, &data[1]));
+        motor_set_target(&motB, motor_compact_target(&motB, &data[3]));
+        break;
+    case I2C_CMD_STAGE_TARGETS:
+        data = TWIC_waitForData(I2C_CMD_STAGE_TARGETS_BYTES);
+        if (data == 0)
+            return;
+        motor_stage_target(&motA, motor_compact_target(&motA, &data[1]));
+        motor_stage_target(&motB, motor_compact_target(&motB, &data[3]));
+        break;
+    case I2C_CMD_LATCH:
+        /* already done by the interrupt and the tick */
+        break;
+    case I2C_CMD_ENUMERATE:
+    case I2C_CMD_ASSIGN:
+        /* already done by the interrupt */
+        break;
+    case I2C_CMD_EXCHANGE:
+        /* the reply was staged; the targets are optional */
+        if (twi_frame_len == 1)
+            break;
+        data = TWIC_waitForData(I2C_CMD_EXCHANGE_BYTES);
+        if (data == 0)
+            return;
+        motor_set_target(&motA, motor_compact_target(&motA, &data[1]));
+        motor_set_target(&motB, motor_compact_target(&motB, &data[3]));
+        break;
+    case I2C_CMD_SET_MOVE_VELOCITY:
+    case I2C_CMD_SET_MOVE_ACCELERATION:
+    case I2C_CMD_SET_MOVE_JERK:
+        data = TWIC_waitForData(I2C_CMD_SET_MOVE_VELOCITY_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        TWIC_SetMoveLimit(&mot->motion, command,
+                          fix_from_float_bits(read_u32(&data[2]), 0));
+        break;
+    case I2C_CMD_MOVE:
+        data = TWIC_waitForData(I2C_CMD_MOVE_BYTES);
+        if (data == 0)
+            return;
+        mot = (data[1] & (1<<7)) ? &motB : &motA;
+        motor_move(mot, fix_from_float_bits(read_u32(&data[2]), 0));
+        break;
+    case I2C_CMD_PUSH_WAYPOINTS:
+        TWIC_PushWaypoint();
+        break;
+    case I2C_CMD_REGISTERS:
+        TWIC_Registers();
+        break;
+    case I2C_CMD_SET_TELEMETRY:
+        data = TWIC_waitForData(I2C_CMD_SET_TELEMETRY_BYTES);
+        if (data == 0)
+            return;
+        telem_config(data[1], read_u16(&data[2]));
+        break;
+    case I2C_CMD_SET_CAPTURE:
+        data = TWIC_waitForData(I2C_CMD_SET_CAPTURE_BYTES);
+        if (data == 0)
+            return;
+        telem_capture(data[1], read_u16(&data[2]), data[4],
+                      (int16_t)read_u16(&data[5]), data[7]);
         break;
         
         //Data out here
@@ -187,15 +682,163 @@ void TWIC_Decode()
         break;
     case I2C_CMD_GET_MESSAGES:
         break;
+    case I2C_CMD_GET_SCHED_OVERRUNS:
+        write_u16(&reply[0], sched_groups[SCHED_GROUP_CONTROL].overruns);
+        write_u16(&reply[2], sched_groups[SCHED_GROUP_SUPERVISE].overruns);
+        write_u16(&reply[4], sched_groups[SCHED_GROUP_HOUSEKEEPING].overruns);
+        TWIC_Publish(6);
+        break;
+    case I2C_CMD_GET_PROFILE:
+    case I2C_CMD_GET_PROFILE_HISTOGRAM:
+        data = TWIC_waitForData(I2C_CMD_GET_PROFILE_BYTES);
+        if (data == 0)
+            return;
+        TWIC_ReplyProfile(command, data[1]);
+        break;
+    case I2C_CMD_GET_MOTION_STATUS:
+        data = TWIC_waitForData(I2C_CMD_GET_MOTION_STATUS_BYTES);
+        if (data == 0)
+            return;
+        TWIC_ReplyMotion((data[1] & (1<<7)) ? &motB : &motA);
+        break;
+    case I2C_CMD_GET_PATH_STATUS:
+        data = TWIC_waitForData(I2C_CMD_GET_PATH_STATUS_BYTES);
+        if (data == 0)
+            return;
+        TWIC_ReplyPath((data[1] & (1<<7)) ? &motB : &motA);
+        break;
+    case I2C_CMD_GET_TELEMETRY:
+        telem_begin_read();
+        break;
+    case I2C_CMD_GET_TELEMETRY_STATUS:
+        telem_status(reply);
+        TWIC_Publish(TELEM_STATUS_BYTES);
+        break;
+    case I2C_CMD_GET_ANALOG:
+        data = TWIC_waitForData(I2C_CMD_GET_ANALOG_BYTES);
+        if (data == 0 || data[1] >= ANALOG_CHANNELS)
+            return;
+        write_u16(&reply[0], analog_read(data[1]));
+        write_u16(&reply[2], analog_sweeps());
+        TWIC_Publish(4);
+        break;
+    }
+}
+
+/* limits can't be negative; a negative one is taken as zero, which
+ * refuses moves (or, for jerk, means no jerk limit) */
+void TWIC_SetMoveLimit(motion_t* m, uint8_t command, int32_t value)
+{
+    uint32_t limit = value < 0 ? 0 : value;
+
+    if (command == I2C_CMD_SET_MOVE_VELOCITY)
+        m->vmax = limit;
+    else if (command == I2C_CMD_SET_MOVE_ACCELERATION)
+        m->amax = limit;
+    else
+        m->jmax = limit;
+}
+
+/* status byte, setpoint and time left */
+void TWIC_ReplyMotion(motor_channel_t* mot)
+{
+    uint8_t* reply = TWIC_Reply();
+    motor_snap_t snap;
+
+    motor_snapshot(mot, &snap);
+    reply[0] = motion_status(&mot->motion);
+    write_u32(&reply[1], snap.target);
+    write_u16(&reply[5], ticks_to_ms(motion_remaining(&mot->motion)));
+    TWIC_Publish(7);
+}
+
+/* queue each whole waypoint in the frame; any move is cancelled */
+void TWIC_PushWaypoint(void)
+{
+    register8_t* data = twi_frame;
+    register8_t* w;
+    motor_channel_t* mot;
+    uint8_t n;
+
+    if (twi_frame_len < I2C_CMD_PUSH_WAYPOINTS_BYTES + 1)
+        return;
+    mot = (data[1] & (1<<7)) ? &motB : &motA;
+    motion_cancel(&mot->motion);
+    for (n = I2C_CMD_PUSH_WAYPOINTS_BYTES + 1; n <= twi_frame_len;
+         n += I2C_CMD_PUSH_WAYPOINTS_EACH)
+    {
+        w = &data[n - I2C_CMD_PUSH_WAYPOINTS_EACH];
+        path_push(&mot->path, read_u32(&w[2]), read_u16(&w[0]),
+                  (data[1] & (1<<6)) ? PATH_CUBIC : 0);
     }
 }
 
+/* status byte, free slots, time buffered and run-dry count */
+void TWIC_ReplyPath(motor_channel_t* mot)
+{
+    path_t* p = &mot->path;
+    uint8_t* reply = TWIC_Reply();
+    motor_snap_t snap;
+
+    motor_snapshot(mot, &snap);
+    reply[0] = path_status(p);
+    reply[1] = path_free(p);
+    write_u16(&reply[2], ticks_to_ms(path_remaining(p)));
+    write_u16(&reply[4], snap.path_dry);
+    TWIC_Publish(6);
+}
+
+/* the first byte selects the register, the rest are written from
+ * there on; from TWIC_Decode, so in the main loop like any other
+ * command */
+void TWIC_Registers(void)
+{
+    uint8_t n;
+
+    if (twi_frame_len < 2)
+        return;
+    regmap_select(twi_frame[1]);
+    for (n = 2; n < twi_frame_len; n++)
+        regmap_write(twi_frame[n]);
+}
+
+/* reply with one profiler probe's statistics */
+void TWIC_ReplyProfile(uint8_t command, uint8_t arg)
+{
+    uint8_t* reply = TWIC_Reply();
+#ifdef PROFILE
+    prof_stats_t st;
+    uint16_t mean;
+
+    prof_read(arg & 0x7f, &st, !!(arg & (1<<7)));
+    if (command == I2C_CMD_GET_PROFILE)
+    {
+        mean = st.count ? st.sum / st.count : 0;
+        /* clock 1 ticks are two CPU cycles */
+        write_u16(&reply[0], st.count ? st.min << 1 : 0);
+        write_u16(&reply[2], st.max << 1);
+        write_u16(&reply[4], mean << 1);
+        write_u16(&reply[6], st.count);
+    }
+    else
+    {
+        for (uint8_t i = 0; i < PROF_HIST_BUCKETS; i++)
+            write_u16(&reply[2*i], st.hist[i]);
+    }
+#else
+    (void)command;
+    (void)arg;
+    memset(reply, 0, 8);
+#endif
+    TWIC_Publish(8);
+}
+
 register8_t* TWIC_waitForData(int bytes)
 {
-    if(twiSlave.bytesReceived!=bytes)
+    if(twi_frame_len != bytes + 1)
         return (register8_t*)0;
     
-    return twiSlave.receivedData;
+    return twi_frame;
 }
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
@@ -208,82 +851,60 @@ void init_clock(void)
     //////////////////////////////////////////////////////////
     /* system clock setup */
 
-    /* start the 32MHz ring oscillator ticking */
-    /* ticks at 32MHz */
-    CLKSYS_Enable(OSC_RC32MEN_bm);
-    
-    /* set the clock prescaler to divide by 1 */
+    /* run from the 32MHz ring oscillator, prescalers dividing by 1 */
     /* ticks at 32MHz */
-    CLKSYS_Prescalers_Config(CLK_PSADIV_1_gc, CLK_PSBCDIV_1_1_gc);
+    hal_clock_init();
 
-    /* enable mid-priority interrupts */
-    PMIC.CTRL |= PMIC_MEDLVLEN_bm;
-    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+    /* enable mid- and low-priority interrupts; TWI is the only high
+     * one */
+    hal_irq_enable(HAL_INTLVL_MED);
+    hal_irq_enable(HAL_INTLVL_LO);
 
     //////////////////////////////////////////////////////////
     /* clock 1 setup */
     /* we use clock 1 for control loops because the avr-gcc headers
      * only have the registers for PWMing TC0 */
 
-    /* medium-priority interrupt */
-    TCC1.INTCTRLA = (TCC1.INTCTRLA & ~TC1_OVFINTLVL_gm) | TC_OVFINTLVL_MED_gc;
-
-    /* divide main clock source by 2 */
-    /* ticks at 16MHz */
-    TCC1.CTRLA = (TCC1.CTRLA & ~TC1_CLKSEL_gm) | TC_CLKSEL_DIV2_gc;
-
-    /* count to 1600 before looping. */
+    /* medium-priority interrupt, ticks at 16MHz, count to 1600 before
+     * looping. */
     /* ticks at 10kHz */
     /* we use this for handling control loops */
-    TCC1.PER = 1600;
+    hal_tick_init(CONTROL_PERIOD, HAL_INTLVL_MED);
+
+#ifdef PROFILE
+    /* the profiler timestamps with clock 1's counter */
+    prof_init(CONTROL_PERIOD + 1);
+#endif
 
     //////////////////////////////////////////////////////////
     /* clock 0 setup */
-    
-    TCD0.CTRLB = 0x00;
 
-    /* low-priority interrupt */
-    TCD0.INTCTRLA = (TCD0.INTCTRLA & ~TC0_OVFINTLVL_gm) | TC_OVFINTLVL_LO_gc;
-
-    /* divide main clock source by 2 */
-    /* ticks at 16MHz */
-    TCD0.CTRLA = (TCD0.CTRLA & ~TC0_CLKSEL_gm) | TC_CLKSEL_DIV2_gc;
-
-    /* count to 65536 before looping. */
+    /* ticks at 16MHz, count to 65536 before looping until
+     * motor_set_pwm_mode() picks a shorter period. */
     /* ticks at about 250Hz */
-    /* we use its A and B comparators for motor PWM */
-    TCD0.PER = PWM_PERIOD;
-
-    /* single-slope PWM with both CCA and CCB enabled */
-    TCD0.CTRLB = (TCD0.CTRLB & ~TC0_WGMODE_gm) | TC_WGMODE_SS_gc | TC0_CCAEN_bm | TC0_CCBEN_bm;
-
-    //////////////////////////////////////////////////////////
-    /* start things ticking */
-
-    /* wait until the 32MHz oscillator is stable */
-    do {nop();} while (CLKSYS_IsReady(OSC_RC32MRDY_bm) == 0);
-    /* and select it */
-    CLKSYS_Main_ClockSource_Select(CLK_SCLKSEL_RC32M_gc);
+    /* we use its A and B comparators for motor PWM; the compares are
+     * written by do_motors when they change, so there's no interrupt */
+    pwm_period = pwm_periods[I2C_PWM_MODE_LEGACY];
+    hal_pwm_init(pwm_period);
 }
 
 /* Clock 1 interrupt */
 /* Clock 1 ticks at 10kHz */
-/* use this for control loop */
-ISR(TCC1_OVF_vect)
+/* use this for control loop; everything slower runs from main() */
+ISR(HAL_TICK_vect)
 {
-    do_leds();
-    do_sensors();
-    do_motors();
-    do_digout();
-}
+    PROF_ENTER(PROF_CONTROL_ISR);
+    sched_tick(&sched_groups[SCHED_GROUP_CONTROL]);
+    PROF_EXIT(PROF_CONTROL_ISR);
 
-ISR(TCD0_OVF_vect)
-{
-    /* Set the clock to motA duty cycle */
-    TCD0.CCABUF = PWM_PERIOD - motA.duty;
-    
-    /* Set the clock to motB duty cycle */
-    TCD0.CCBBUF = PWM_PERIOD - motB.duty;
+    /* if the clock has already wrapped again we took longer than a
+     * whole tick; the count is read from the TWI interrupt */
+    if (hal_tick_pending())
+    {
+        AVR_ENTER_CRITICAL_REGION();
+        sched_groups[SCHED_GROUP_CONTROL].overruns++;
+        AVR_LEAVE_CRITICAL_REGION();
+    }
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -292,14 +913,256 @@ ISR(TCD0_OVF_vect)
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
+/* The encoders are counted by the quadrature decoders; all we do per
+ * tick is extend the counts to 32 bits. The analog inputs are swept
+ * by the ADC interrupt, started by the PWM timer. */
 void init_sensors(void)
 {
+    analog_init();
+    analog_ticks = 0;
+    hal_adc_init(ANALOG_PHASE, HAL_INTLVL_MED);
+
+    hal_qdec_init(HAL_QDEC_A);
+    hal_qdec_init(HAL_QDEC_B);
+    encoder_init(&encA, hal_qdec_count(HAL_QDEC_A));
+    encoder_init(&encB, hal_qdec_count(HAL_QDEC_B));
+
+    sensor_functions[SENSOR_ENCODER_A] = sensor_encoder_a;
+    sensor_functions[SENSOR_ENCODER_B] = sensor_encoder_b;
+    sensor_functions[SENSOR_ENCODER_A_VELOCITY] = sensor_encoder_a_velocity;
+    sensor_functions[SENSOR_ENCODER_B_VELOCITY] = sensor_encoder_b_velocity;
+    sensor_functions[SENSOR_ANALOG_1] = sensor_analog_1;
+    sensor_functions[SENSOR_ANALOG_2] = sensor_analog_2;
+    sensor_functions[SENSOR_ANALOG_3] = sensor_analog_3;
+    sensor_functions[SENSOR_ANALOG_4] = sensor_analog_4;
+    sensor_functions[SENSOR_ANALOG_5] = sensor_analog_5;
+    sensor_functions[SENSOR_ANALOG_6] = sensor_analog_6;
+}
+
+/* same level as the control tick, so a tick never sees a sweep half
+ * published */
+ISR(HAL_ADC_vect)
+{
+    uint16_t result = hal_adc_result();
+    uint8_t motor;
+
+    PROF_ENTER(PROF_ADC_ISR);
+    motor = analog_convert(result);
+    if (motor != ANALOG_NONE)
+    {
+        motor_current(motor ? &motB : &motA, result);
+        motor_current_phase();
+    }
+    PROF_EXIT(PROF_ADC_ISR);
+}
+
+int32_t sensor_encoder_a(void)
+{
+    return encA.position;
+}
+
+int32_t sensor_encoder_b(void)
+{
+    return encB.position;
+}
+
+int32_t sensor_encoder_a_velocity(void)
+{
+    return encoder_velocity(&encA, CONTROL_RATE_HZ);
+}
+
+int32_t sensor_encoder_b_velocity(void)
+{
+    return encoder_velocity(&encB, CONTROL_RATE_HZ);
+}
+
+int32_t sensor_analog_1(void)
+{
+    return analog_read(0);
+}
+
+int32_t sensor_analog_2(void)
+{
+    return analog_read(1);
+}
+
+int32_t sensor_analog_3(void)
+{
+    return analog_read(2);
+}
+
+int32_t sensor_analog_4(void)
+{
+    return analog_read(3);
+}
+
+int32_t sensor_analog_5(void)
+{
+    return analog_read(4);
+}
+
+int32_t sensor_analog_6(void)
+{
+    return analog_read(5);
+}
+
+/* is the channel's bridge being driven by its current loop */
+static bool motor_inner(const motor_channel_t* mot)
+{
+    return mot->closed && (mot->cascade & I2C_CASCADE_CURRENT);
+}
+
+/* Run one channel's controller, and the velocity stage after it if
+ * there is one. The last stage's output is the channel's command, or
+ * the current loop's target. Each stage runs every so many ticks and
+ * its output holds in between. */
+static void do_controller(motor_channel_t* mot)
+{
+    sensorfunc get;
+    int32_t out;
+
+    get = sensor_functions[mot->sensorchan & 0x0f];
+    mot->measured = get ? get() : 0;
+
+    /* open loop, the target is the duty cycle */
+    if (!mot->closed)
+    {
+        mot->command = fix_clamp(mot->cont.target, -DUTY_MAX, DUTY_MAX);
+        return;
+    }
+    /* nothing to close the loop on: don't drive the motor at all,
+     * rather than keep whatever it was last given */
+    if (get == 0)
+    {
+        mot->command = 0;
+        mot->current.target = 0;
+        return;
+    }
+
+    if (motion_update(&mot->motion))
+        mot->cont.target = mot->motion.setpoint;
+    if (path_update(&mot->path))
+        mot->cont.target = mot->path.setpoint;
+
+    if (++mot->outer_tick >= mot->outer_div)
+    {
+        mot->outer_tick = 0;
+        mot->outer_out = pid_update(&mot->cont, mot->measured);
+    }
+    out = mot->outer_out;
+
+    if (mot->cascade & I2C_CASCADE_VELOCITY)
+    {
+        get = sensor_functions[mot->vel_sensor & 0x0f];
+        mot->vel.target = out;
+        if (get && ++mot->vel_tick >= mot->vel_div)
+        {
+            mot->vel_tick = 0;
+            mot->vel_out = pid_update(&mot->vel, get());
+        }
+        out = mot->vel_out;
+    }
+
+    if (mot->cascade & I2C_CASCADE_CURRENT)
+        mot->current.target = (int16_t)out;
+    else
+        mot->command = out;
+}
+
+static void snapshot_channel(motor_channel_t* mot,
+                             const encoder_t* enc, motor_snap_t* snap)
+{
+    snap->target = mot->cont.target;
+    snap->measured = mot->measured;
+    snap->error = mot->cont.e_cur;
+    snap->drive = mot->output.drive;
+    snap->path_dry = mot->path.dry;
+    snap->motion_left = motion_remaining(&mot->motion);
+    snap->path_left = path_running(&mot->path);
+    snap->moved = enc->position - enc->history[enc->idx];
+    snap->tick = sched_ticks;
+}
+
+/* fill in the copy readers aren't using, then switch them to it */
+static void publish_snapshots(void)
+{
+    motor_snap_t* next = motor_snaps[!motor_snap_idx];
+
+    snapshot_channel(&motA, &encA, &next[0]);
+    snapshot_channel(&motB, &encB, &next[1]);
+    /* the copies aren't volatile, so without this the compiler could
+     * move their stores past the flip */
+    __asm__ volatile("" ::: "memory");
+    motor_snap_idx = !motor_snap_idx;
+    motor_snap_seq++;
+}
+
+/* The latest complete snapshot of a channel, from outside the control
+ * tick. A tick that comes in while we're copying writes the other
+ * copy, so the one we have is only spoiled if a second tick comes in
+ * too; the sequence count spots that and we go again. */
+void motor_snapshot(const motor_channel_t* mot, motor_snap_t* snap)
+{
+    uint8_t seq;
+
+    do
+    {
+        seq = motor_snap_seq;
+        /* and here the copy must stay between the two reads of the
+         * count */
+        __asm__ volatile("" ::: "memory");
+        *snap = motor_snaps[motor_snap_idx][mot == &motB];
+        __asm__ volatile("" ::: "memory");
+    } while ((uint8_t)(motor_snap_seq - seq) >= 2);
+}
+
+/* the control tick's part of the latch and the go timeout */
+static void do_latch(void)
+{
+    if (twi_latch)
+    {
+        twi_latch = false;
+        if (motA.staged)
+            motA.cont.target = motA.staged_target;
+        if (motB.staged)
+            motB.cont.target = motB.staged_target;
+        motA.staged = false;
+        motB.staged = false;
+        go_left = go_timeout;
+    }
+
+    /* the master has gone quiet: stop both motors where they are */
+    if (go_left && --go_left == 0)
+    {
+        motA.closed = false;
+        motB.closed = false;
+        motA.cont.target = 0;
+        motB.cont.target = 0;
+        motA.command = 0;
+        motB.command = 0;
+    }
 }
 
 /* read sensors */
 /* update PID controllers */
 void do_sensors(void)
 {
+    PROF_ENTER(PROF_SENSORS);
+    encoder_update(&encA, hal_qdec_count(HAL_QDEC_A));
+    encoder_update(&encB, hal_qdec_count(HAL_QDEC_B));
+    if (++analog_ticks >= ANALOG_TICKS)
+    {
+        analog_ticks = 0;
+        analog_start();
+    }
+    do_latch();
+    PROF_ENTER(PROF_CONTROLLERS);
+    do_controller(&motA);
+    do_controller(&motB);
+    PROF_EXIT(PROF_CONTROLLERS);
+    publish_snapshots();
+    telem_sample();
+    PROF_EXIT(PROF_SENSORS);
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -311,52 +1174,378 @@ void do_sensors(void)
 void init_motors(void)
 {
     /* enable motor pins */
-    PORTD.DIRSET |= PIN_MOT_CONTROL_EN_1|PIN_MOT_CONTROL_EN_2;
-    PORTD.DIRSET |= PIN_MOT_CONTROL_A_2|PIN_MOT_CONTROL_B_2;
-    PORTD.DIRSET |= PIN_MOT_CONTROL_A_1|PIN_MOT_CONTROL_B_1;
+    hal_gpio_output(HAL_PORTD, PIN_MOT_CONTROL_EN_1|PIN_MOT_CONTROL_EN_2);
+    hal_gpio_output(HAL_PORTD, PIN_MOT_CONTROL_A_2|PIN_MOT_CONTROL_B_2);
+    hal_gpio_output(HAL_PORTD, PIN_MOT_CONTROL_A_1|PIN_MOT_CONTROL_B_1);
     
     /* clear out motor structs */
-    motA.duty = 0;
+    motA.command = 0;
     motA.sensorchan = 0; 
     motA.closed = false;
-    motA.direction = false;
-    motA.cont.P = 0.0;
-    motA.cont.I = 0.0;
-    motA.cont.D = 0.0;
-    motA.cont.e_last = 0.0;
-    motA.cont.e_cur = 0.0;
-    motA.cont.e_int = 0.0;
-    motA.cont.target = 0.0;
-
-    motB.duty = 0;
+    output_init(&motA.output);
+    motA.out_duty = 0;
+    motA.out_residue = 0;
+    motA.out_pins = MOTOR_PINS_FORWARD;
+    motA.measured = 0;
+    motA.target_shift = 0;
+    motA.gain_shift = 0;
+    motA.target_base = 0;
+    motA.staged = false;
+    pid_init(&motA.cont, FIX_Q16, CONTROL_RATE_HZ,
+             -(int32_t)DUTY_MAX, DUTY_MAX);
+    pid_init(&motA.vel, FIX_Q16, CONTROL_RATE_HZ,
+             -(int32_t)DUTY_MAX, DUTY_MAX);
+    current_init(&motA.current, CURRENT_RATE(pwm_period), DUTY_MAX);
+    motA.cascade = 0;
+    motA.vel_sensor = 0;
+    motA.outer_div = 1;
+    motA.vel_div = 1;
+    motA.outer_tick = 0;
+    motA.vel_tick = 0;
+    motA.outer_out = 0;
+    motA.vel_out = 0;
+    motion_init(&motA.motion);
+    path_init(&motA.path);
+
+    motB.command = 0;
     motB.sensorchan = 0; 
     motB.closed = false;
-    motB.direction = false;
-    motB.cont.P = 0.0;
-    motB.cont.I = 0.0;
-    motB.cont.D = 0.0;
-    motB.cont.e_last = 0.0;
-    motB.cont.e_cur = 0.0;
-    motB.cont.e_int = 0.0;
-    motB.cont.target = 0.0;
+    output_init(&motB.output);
+    motB.out_duty = 0;
+    motB.out_residue = 0;
+    motB.out_pins = MOTOR_PINS_FORWARD;
+    motB.measured = 0;
+    motB.target_shift = 0;
+    motB.gain_shift = 0;
+    motB.target_base = 0;
+    motB.staged = false;
+    pid_init(&motB.cont, FIX_Q16, CONTROL_RATE_HZ,
+             -(int32_t)DUTY_MAX, DUTY_MAX);
+    pid_init(&motB.vel, FIX_Q16, CONTROL_RATE_HZ,
+             -(int32_t)DUTY_MAX, DUTY_MAX);
+    current_init(&motB.current, CURRENT_RATE(pwm_period), DUTY_MAX);
+    motB.cascade = 0;
+    motB.vel_sensor = 0;
+    motB.outer_div = 1;
+    motB.vel_div = 1;
+    motB.outer_tick = 0;
+    motB.vel_tick = 0;
+    motB.outer_out = 0;
+    motB.vel_out = 0;
+    motion_init(&motB.motion);
+    path_init(&motB.path);
+
+    /* both bridges off and set forward, which is what the out_ fields
+     * say they are */
+    motA.out_compare = pwm_period;
+    motB.out_compare = pwm_period;
+    hal_pwm_set(HAL_PWM_A, pwm_period);
+    hal_pwm_set(HAL_PWM_B, pwm_period);
+    hal_gpio_set(HAL_PORTD, PIN_MOT_CONTROL_B_1|PIN_MOT_CONTROL_B_2);
+    hal_gpio_clr(HAL_PORTD, PIN_MOT_CONTROL_A_1|PIN_MOT_CONTROL_A_2);
+}
+
+/* The mode byte is the same as the set motor sensor channel command's:
+ * bit 6 closes the loop and the low nibble picks the sensor. Changing
+ * it stops any move or path and restarts the controller. */
+void motor_set_mode(motor_channel_t* mot, uint8_t mode)
+{
+    mot->closed = !!(mode & (1 << 6));
+    mot->sensorchan = mode & 0x0f;
+    motion_cancel(&mot->motion);
+    path_clear(&mot->path);
+    pid_reset(&mot->cont);
+    pid_reset(&mot->vel);
+    current_reset(&mot->current);
+    mot->outer_out = 0;
+    mot->vel_out = 0;
+}
+
+/* a new target replaces any move or path */
+void motor_set_target(motor_channel_t* mot, int32_t target)
+{
+    motion_cancel(&mot->motion);
+    path_clear(&mot->path);
+    mot->cont.target = target;
+}
+
+/* a compact target or gain, from a 16-bit int in buf */
+int32_t motor_compact_target(motor_channel_t* mot, register8_t* buf)
+{
+    int64_t t = (int64_t)(int16_t)read_u16(buf) << mot->target_shift;
+
+    return fix_add(mot->target_base, fix_sat(t));
+}
+
+fix_t motor_compact_gain(motor_channel_t* mot, register8_t* buf)
+{
+    return fix_sat((int64_t)(int16_t)read_u16(buf) << mot->gain_shift);
+}
+
+/* Hold the channel where it is until the next latch sets its target.
+ * Called from the main loop with interrupts off. */
+void motor_stage_target(motor_channel_t* mot, int32_t target)
+{
+    motion_cancel(&mot->motion);
+    path_clear(&mot->path);
+    mot->staged_target = target;
+    mot->staged = true;
+}
+
+void motor_move(motor_channel_t* mot, int32_t target)
+{
+    path_clear(&mot->path);
+    motion_request(&mot->motion, target);
 }
 
-/* Called by clock 1 at 100kHz */
+/* The compare for a channel's duty cycle in the current PWM mode; the
+ * outputs are switched on for the end of the period, after the
+ * compare. In the faster modes a duty cycle usually falls between two
+ * steps. What's left over is carried to the next tick, so the compare
+ * dithers between the two and on average the bridge gets the whole
+ * 16-bit duty cycle. */
+static uint16_t pwm_compare(motor_channel_t* mot)
+{
+    uint32_t on = (uint32_t)mot->out_duty * (pwm_period + 1UL);
+    uint16_t steps;
+
+    if (mot->out_duty)
+        on += mot->out_residue;
+    mot->out_residue = (uint16_t)on;
+    /* the carry can take a duty cycle just short of full over the
+     * top, and a compare past the period never matches, which is off */
+    steps = on >> 16;
+    if (steps > pwm_period)
+        steps = pwm_period;
+    return pwm_period - steps;
+}
+
+/* write a channel's compare if it's changed */
+static void pwm_write(motor_channel_t* mot, hal_pwm_e pwm)
+{
+    uint16_t compare = pwm_compare(mot);
+
+    if (compare == mot->out_compare)
+        return;
+    hal_pwm_set(pwm, compare);
+    mot->out_compare = compare;
+}
+
+/* The current sense sample is taken in the middle of the bridge's on
+ * time, which runs from the compare to the end of the period, so it
+ * stays inside it however short it gets. The phase and the compares
+ * are both buffered until the end of the period, so this is worked out
+ * from the compare the next period runs on, for the motor whose turn
+ * it is next. */
+static void motor_current_phase(void)
+{
+    uint8_t next = analog_current_next();
+    motor_channel_t* mot;
+
+    if (next == ANALOG_NONE)
+        return;
+    mot = next ? &motB : &motA;
+    hal_adc_phase(mot->out_compare + (pwm_period - mot->out_compare) / 2);
+}
+
+/* The current loops run once a period, or every other period with
+ * both running, since they take turns at the trigger; with none
+ * running the ADC trigger goes back to where the sweep wants it. */
+static void motor_current_timing(void)
+{
+    uint8_t sensed = !!(motA.cascade & I2C_CASCADE_CURRENT)
+        + !!(motB.cascade & I2C_CASCADE_CURRENT);
+    uint16_t rate = CURRENT_RATE(pwm_period) / (sensed ? sensed : 1);
+    bool sensing = sensed != 0;
+
+    motA.current.rate = rate;
+    motB.current.rate = rate;
+    current_prepare(&motA.current);
+    current_prepare(&motB.current);
+    if (sensing)
+        motor_current_phase();
+    else
+        hal_adc_phase(ANALOG_PHASE);
+}
+
+/* Set up a channel's cascade: I2C_CASCADE_VELOCITY puts a velocity
+ * stage after the controller, I2C_CASCADE_CURRENT makes the last stage
+ * command a current, limited to limit ADC counts, sensed on analog
+ * input (0-5). The stages run every outer_div and vel_div ticks. Both
+ * stages and the current loop start again from nothing. Called with
+ * the control interrupts held off. */
+void motor_set_cascade(motor_channel_t* mot, uint8_t cascade, uint8_t input,
+                       uint8_t vel_sensor, uint8_t outer_div,
+                       uint8_t vel_div, uint16_t limit)
+{
+    int32_t last = DUTY_MAX;
+
+    if (limit > CURRENT_LIMIT_MAX)
+        limit = CURRENT_LIMIT_MAX;
+    if (cascade & I2C_CASCADE_CURRENT)
+        last = limit;
+
+    mot->cascade = cascade;
+    mot->vel_sensor = vel_sensor;
+    mot->outer_div = outer_div ? outer_div : 1;
+    mot->vel_div = vel_div ? vel_div : 1;
+    mot->outer_tick = 0;
+    mot->vel_tick = 0;
+    mot->outer_out = 0;
+    mot->vel_out = 0;
+
+    /* the stage that feeds the bridge or the current loop is limited
+     * to what that takes; one that feeds the velocity stage isn't */
+    mot->vel.out_min = -last;
+    mot->vel.out_max = last;
+    if (cascade & I2C_CASCADE_VELOCITY)
+        last = PID_ERROR_MAX;
+    mot->cont.out_min = -last;
+    mot->cont.out_max = last;
+
+    pid_set_rate(&mot->cont, CONTROL_RATE_HZ / mot->outer_div);
+    pid_set_rate(&mot->vel, CONTROL_RATE_HZ / mot->vel_div);
+    pid_reset(&mot->cont);
+    pid_reset(&mot->vel);
+    current_reset(&mot->current);
+    mot->current.target = 0;
+
+    analog_set_current(mot == &motB,
+                       (cascade & I2C_CASCADE_CURRENT) ? input : ANALOG_NONE);
+    motor_current_timing();
+}
+
+/* Switch PWM mode. The new period and both channels' compares,
+ * rescaled to it, are buffered together, so the timer changes over
+ * cleanly at the end of the period it's in. */
+void motor_set_pwm_mode(uint8_t mode)
+{
+    if (mode >= I2C_PWM_MODES)
+        return;
+
+    HAL_ENTER_CONTROL_REGION();
+    pwm_period = pwm_periods[mode];
+    hal_pwm_period(pwm_period);
+    motA.out_residue = 0;
+    motB.out_residue = 0;
+    motA.out_compare = pwm_compare(&motA);
+    motB.out_compare = pwm_compare(&motB);
+    hal_pwm_set(HAL_PWM_A, motA.out_compare);
+    hal_pwm_set(HAL_PWM_B, motB.out_compare);
+    motor_current_timing();
+    HAL_LEAVE_CONTROL_REGION();
+}
+
+/* Run one channel's command through its output stage and drive the
+ * bridge with the result, touching the hardware only when something
+ * has changed. The PWM drives the bridge's enable, so the off part of
+ * each period coasts; a drive of zero either coasts too or, with
+ * brake set, pulls both inputs low and enables the bridge all the
+ * time, which shorts the motor.
+ *
+ * The compare is double buffered and taken up at the start of the
+ * next PWM period, but the input pins switch the moment they're
+ * written, so changing them is done in steps: the compare goes to
+ * off, we wait until the timer has taken that up, then switch the
+ * pins and write the new duty for the period after. The bridge never
+ * runs the old duty with the new pins, and a change costs at most a
+ * PWM period or two on top of the output stage's dead-band. */
+static void motor_output(motor_channel_t* mot, hal_pwm_e pwm,
+                         uint8_t fwd_pin, uint8_t rev_pin)
+{
+    int32_t drive = output_update(&mot->output, mot->command);
+    uint8_t pins = mot->out_pins;
+    uint16_t duty = 0;
+
+    if (drive > 0)
+    {
+        pins = MOTOR_PINS_FORWARD;
+        duty = drive;
+    }
+    else if (drive < 0)
+    {
+        pins = MOTOR_PINS_REVERSE;
+        duty = -drive;
+    }
+    else if (mot->output.brake)
+    {
+        pins = MOTOR_PINS_BRAKE;
+        duty = DUTY_MAX;
+    }
+
+    if (pins != mot->out_pins)
+    {
+        if (mot->out_duty)
+        {
+            mot->out_duty = 0;
+            pwm_write(mot, pwm);
+            return;
+        }
+        if (hal_pwm_pending(pwm))
+            return;
+
+        /* the bridge is disabled, so passing through both low on the
+         * way doesn't matter */
+        mot->out_pins = pins;
+        hal_gpio_clr(HAL_PORTD, fwd_pin | rev_pin);
+        if (pins == MOTOR_PINS_FORWARD)
+            hal_gpio_set(HAL_PORTD, fwd_pin);
+        if (pins == MOTOR_PINS_REVERSE)
+            hal_gpio_set(HAL_PORTD, rev_pin);
+    }
+
+    if (duty != mot->out_duty || mot->out_residue)
+    {
+        mot->out_duty = duty;
+        pwm_write(mot, pwm);
+    }
+}
+
+
+/* drive a channel's bridge with its command */
+static void motor_drive(motor_channel_t* mot)
+{
+    if (mot == &motA)
+        motor_output(&motA, HAL_PWM_A, PIN_MOT_CONTROL_B_1, PIN_MOT_CONTROL_A_1);
+    else
+        motor_output(&motB, HAL_PWM_B, PIN_MOT_CONTROL_B_2, PIN_MOT_CONTROL_A_2);
+}
+
+/* Called from the ADC interrupt with a channel's current sense sample,
+ * once per PWM period or, with both channels' sensed, every other. The sense output has no sign, so the current is
+ * taken to flow the way the bridge is driving. The current loop's
+ * output goes through the output stage to the bridge from here, so
+ * the slew limit is per PWM period for these channels. */
+static void motor_current(motor_channel_t* mot, uint16_t sense)
+{
+    int16_t i = (int16_t)sense;
+
+    if (!motor_inner(mot))
+        return;
+    if (mot->out_pins == MOTOR_PINS_REVERSE)
+        i = -i;
+    mot->command = current_update(&mot->current, i);
+    motor_drive(mot);
+}
+
+/* Called by clock 1 at 10kHz */
 void do_motors(void)
 {
-    if (motA.duty) led_mota->behavior = LED_BEHAVIOR_ON;
+    PROF_ENTER(PROF_MOTORS);
+
+    if (motA.output.drive) led_mota->behavior = LED_BEHAVIOR_ON;
     else led_mota->behavior = LED_BEHAVIOR_OFF;
-    if (motB.duty) led_motb->behavior = LED_BEHAVIOR_ON;
+    if (motB.output.drive) led_motb->behavior = LED_BEHAVIOR_ON;
     else led_motb->behavior = LED_BEHAVIOR_OFF;
 
-    
-    /* Set the Direction for motA */
-    PORTD.OUTSET = (motA.direction ? PIN_MOT_CONTROL_A_1 : PIN_MOT_CONTROL_B_1);
-    PORTD.OUTCLR = (motA.direction ? PIN_MOT_CONTROL_B_1 : PIN_MOT_CONTROL_A_1);
-    
-    /* Set the Direction for motB */
-    PORTD.OUTSET = (motB.direction ? PIN_MOT_CONTROL_A_2 : PIN_MOT_CONTROL_B_2);
-    PORTD.OUTCLR = (motB.direction ? PIN_MOT_CONTROL_B_2 : PIN_MOT_CONTROL_A_2);
+    /* a channel with its current loop running is driven from that */
+    if (!motor_inner(&motA))
+        motor_drive(&motA);
+    if (!motor_inner(&motB))
+        motor_drive(&motB);
+    motor_current_phase();
+
+    PROF_EXIT(PROF_MOTORS);
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -367,9 +1556,9 @@ void do_motors(void)
 
 void init_leds(void)
 {
-    PORTA.DIRSET = PIN_LED_POWER | PIN_LED_ORDERS | PIN_LED_ERROR_1;
-    PORTC.DIRSET = PIN_LED_MOT_A | PIN_LED_MOT_B;
-    PORTE.DIRSET = PIN_LED_ERROR_2;
+    hal_gpio_output(HAL_PORTA, PIN_LED_POWER | PIN_LED_ORDERS | PIN_LED_ERROR_1);
+    hal_gpio_output(HAL_PORTC, PIN_LED_MOT_A | PIN_LED_MOT_B);
+    hal_gpio_output(HAL_PORTE, PIN_LED_ERROR_2);
 
     led_power  = malloc(sizeof(led_t));
     led_orders = malloc(sizeof(led_t));
@@ -415,12 +1604,14 @@ uint8_t led_check_value(led_t* led)
 
 void do_leds(void)
 {
-    PORTA.OUT = (PORTA.OUT & ~PIN_LED_POWER)   | (led_check_value(led_power)  ? PIN_LED_POWER   : 0);
-    PORTA.OUT = (PORTA.OUT & ~PIN_LED_ORDERS)  | (led_check_value(led_orders) ? PIN_LED_ORDERS  : 0);
-    PORTA.OUT = (PORTA.OUT & ~PIN_LED_ERROR_1) | (led_check_value(led_error1) ? PIN_LED_ERROR_1 : 0);
-    PORTE.OUT = (PORTE.OUT & ~PIN_LED_ERROR_2) | (led_check_value(led_error2) ? PIN_LED_ERROR_2 : 0);
-    PORTC.OUT = (PORTC.OUT & ~PIN_LED_MOT_A)   | (led_check_value(led_mota)   ? PIN_LED_MOT_A   : 0);
-    PORTC.OUT = (PORTC.OUT & ~PIN_LED_MOT_B)   | (led_check_value(led_motb)   ? PIN_LED_MOT_B   : 0);
+    PROF_ENTER(PROF_LEDS);
+    hal_gpio_write(HAL_PORTA, PIN_LED_POWER,   led_check_value(led_power));
+    hal_gpio_write(HAL_PORTA, PIN_LED_ORDERS,  led_check_value(led_orders));
+    hal_gpio_write(HAL_PORTA, PIN_LED_ERROR_1, led_check_value(led_error1));
+    hal_gpio_write(HAL_PORTE, PIN_LED_ERROR_2, led_check_value(led_error2));
+    hal_gpio_write(HAL_PORTC, PIN_LED_MOT_A,   led_check_value(led_mota));
+    hal_gpio_write(HAL_PORTC, PIN_LED_MOT_B,   led_check_value(led_motb));
+    PROF_EXIT(PROF_LEDS);
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -429,50 +1620,52 @@ void do_leds(void)
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
+/* The frame goes out on digital 3 and 4 only, two bits at a time, low
+ * bits first: the other digital and analog pins are the encoders' and
+ * the ADC's inputs, and driving them would fight whatever is on
+ * them. The length goes out first, then the frame itself. */
+#define DIGOUT_STEPS 4          /* per byte */
+
 void do_digout(void)
 {
-    if ((digital_send_idx == digital_send_len) && (digital_send_len != 0))
+    PROF_ENTER(PROF_DIGOUT);
+
+    if (digital_send_frame &&
+        digital_send_idx == (digital_send_frame->length + 1) * DIGOUT_STEPS)
     {
         led_error1->behavior = LED_BEHAVIOR_OFF;
 
-        digital_send_len = 0;
+        /* the frame on the pins is always the oldest one */
+        digital_send_frame = 0;
         digital_send_idx = 0;
-        memset(digital_send_buf, 0, 32 * sizeof(uint8_t));
-        PORTA.OUTCLR = PIN_DIGITAL_1;
-        PORTB.OUTCLR = PIN_DIGITAL_2;
-        PORTC.OUTCLR = PIN_DIGITAL_3;
-        PORTE.OUTCLR = PIN_DIGITAL_4;
-        PORTA.OUTCLR = PIN_ANALOG_1;
-        PORTB.OUTCLR = PIN_ANALOG_2;
-        PORTA.OUTCLR = PIN_ANALOG_3;
-        PORTB.OUTCLR = PIN_ANALOG_4;
+        TWI_SlaveFrameRelease(&twiSlave);
+        hal_gpio_clr(HAL_PORTC, PIN_DIGITAL_3);
+        hal_gpio_clr(HAL_PORTE, PIN_DIGITAL_4);
     }
 
-    if (digital_send_idx < digital_send_len)
+    if (digital_send_frame)
     {
         led_error1->behavior = LED_BEHAVIOR_ON;
-        
-        uint8_t cur = digital_send_buf[digital_send_idx];
-        PORTA.OUT = (PORTA.OUT & ~PIN_DIGITAL_1) | ((cur & (1<<0)) ? PIN_DIGITAL_1 : 0);
-        PORTB.OUT = (PORTB.OUT & ~PIN_DIGITAL_2) | ((cur & (1<<1)) ? PIN_DIGITAL_2 : 0);
-        PORTC.OUT = (PORTC.OUT & ~PIN_DIGITAL_3) | ((cur & (1<<2)) ? PIN_DIGITAL_3 : 0);
-        PORTE.OUT = (PORTE.OUT & ~PIN_DIGITAL_4) | ((cur & (1<<3)) ? PIN_DIGITAL_4 : 0);
-        PORTA.OUT = (PORTA.OUT & ~PIN_ANALOG_1)  | ((cur & (1<<4)) ? PIN_ANALOG_1  : 0);
-        PORTB.OUT = (PORTB.OUT & ~PIN_ANALOG_2)  | ((cur & (1<<5)) ? PIN_ANALOG_2  : 0);
-        PORTA.OUT = (PORTA.OUT & ~PIN_ANALOG_3)  | ((cur & (1<<6)) ? PIN_ANALOG_3  : 0);
-        PORTB.OUT = (PORTB.OUT & ~PIN_ANALOG_4)  | ((cur & (1<<7)) ? PIN_ANALOG_4  : 0);
-    
+
+        uint8_t byte = digital_send_idx / DIGOUT_STEPS;
+        uint8_t cur = byte ?
+            digital_send_frame->data[byte - 1] :
+            digital_send_frame->length;
+        cur >>= 2 * (digital_send_idx % DIGOUT_STEPS);
+        hal_gpio_write(HAL_PORTC, PIN_DIGITAL_3,  cur & (1<<0));
+        hal_gpio_write(HAL_PORTE, PIN_DIGITAL_4,  cur & (1<<1));
+
         digital_send_idx++;
     }
+
+    PROF_EXIT(PROF_DIGOUT);
 }
 
 void init_digout(void)
 {
-    PORTA.DIRSET |= PIN_DIGITAL_1 | PIN_ANALOG_1 | PIN_ANALOG_3;
-    PORTB.DIRSET |= PIN_DIGITAL_2 | PIN_ANALOG_2 | PIN_ANALOG_4;
-    PORTC.DIRSET |= PIN_DIGITAL_3;
-    PORTE.DIRSET |= PIN_DIGITAL_4;
-    digital_send_len = 0;
+    hal_gpio_output(HAL_PORTC, PIN_DIGITAL_3);
+    hal_gpio_output(HAL_PORTE, PIN_DIGITAL_4);
+    digital_send_frame = 0;
     digital_send_idx = 0;
 }
 
@@ -483,20 +1676,51 @@ void init_digout(void)
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
+/* assemble little-endian values out of the I2C buffer */
+uint16_t read_u16(register8_t* buf)
+{
+    return ((uint16_t)buf[0]) | ((uint16_t)buf[1] << 8);
+}
+
+uint32_t read_u32(register8_t* buf)
+{
+    return ((uint32_t)buf[0])
+        | ((uint32_t)buf[1] << 8)
+        | ((uint32_t)buf[2] << 16)
+        | ((uint32_t)buf[3] << 24);
+}
+
+/* and the other way around for replies */
+void write_u16(register8_t* buf, uint16_t val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = val >> 8;
+}
+
+void write_u32(register8_t* buf, uint32_t val)
+{
+    write_u16(&buf[0], val & 0xffff);
+    write_u16(&buf[2], val >> 16);
+}
+
+/* control ticks to milliseconds, rounded up and saturated */
+uint16_t ticks_to_ms(uint32_t ticks)
+{
+    uint32_t ms = (ticks * 1000 + CONTROL_RATE_HZ - 1) / CONTROL_RATE_HZ;
+
+    return ms > 0xffff ? 0xffff : ms;
+}
+
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 /// Other
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
-/* main function */
-int main(void)
+/* bring everything up; interrupts are enabled at the end */
+void init_board(void)
 {
-    /* ============================== */
-    /* initialization =============== */
-    /* ============================== */
-    
-    WDT_EnableAndSetTimeout(WDT_PER_512CLK_gc);
+    hal_wdt_enable();
 
     /* set up LED pins */
     init_leds();
@@ -513,37 +1737,77 @@ int main(void)
     /* set up motors */
     init_motors();
 
+    /* telemetry starts off */
+    telem_init();
+
+#ifdef SAULDECODE
     /* set up crude digital outputs */
     init_digout();
+#endif
 
-    /* Flash all the LEDs for two and a half seconds to make sure
-     * they're hooked up */
+    /* Flash all the LEDs for a second or so to make sure they're
+     * hooked up */
     led_orders->behavior = LED_BEHAVIOR_TIMED;
-    led_orders->time = 4000;
+    led_orders->time = 40;
     led_error1->behavior = LED_BEHAVIOR_TIMED;
-    led_error1->time = 6000;
+    led_error1->time = 60;
     led_error2->behavior = LED_BEHAVIOR_TIMED;
-    led_error2->time = 8000;
+    led_error2->time = 80;
     led_mota->behavior = LED_BEHAVIOR_TIMED;
-    led_mota->time = 10000;
+    led_mota->time = 100;
     led_motb->behavior = LED_BEHAVIOR_TIMED;
-    led_motb->time = 12000;
+    led_motb->time = 120;
 
-    /* motA.duty = 4000; */
-    /* motA.direction = 1; */
-    /* motB.duty = 16000; */
-    /* motB.direction = 1; */
+    /* motA.command = -4000; */
+    /* motB.command = -16000; */
 
     /* enable interrupts - things start ticking now */
     sei();
+}
+
+/* one pass of the main loop */
+void do_mainloop(void)
+{
+    /* act on whatever's come in over I2C */
+    TWIC_Process();
+
+    /* fold new gains into the controllers' discrete coefficients
+     * here rather than in the control loop */
+    pid_prepare(&motA.cont);
+    pid_prepare(&motB.cont);
+    pid_prepare(&motA.vel);
+    pid_prepare(&motB.vel);
+
+    /* and plan any moves and path segments that have come in */
+    motion_prepare(&motA.motion, &motA.cont.target, CONTROL_RATE_HZ);
+    motion_prepare(&motB.motion, &motB.cont.target, CONTROL_RATE_HZ);
+    path_prepare(&motA.path, &motA.cont.target);
+    path_prepare(&motB.path, &motB.cont.target);
+
+    /* run whichever of the slower rate groups are due */
+    sched_run(&sched_groups[SCHED_GROUP_SUPERVISE],
+              SCHED_GROUP_COUNT - SCHED_GROUP_SUPERVISE);
+
+    hal_wdt_reset();
+}
 
+/* main function */
+/* the host build has its own, in host/host_main.c */
+#ifndef HAL_HOST
+int main(void)
+{
+    /* ============================== */
+    /* initialization =============== */
+    /* ============================== */
+    
+    init_board();
 
     /* ============================== */
     /* main loop ==================== */
     /* ============================== */
     for(;;)
     {
-        _delay_us(10);
-        WDT_Reset();
+        do_mainloop();
     }
 }
+#endif
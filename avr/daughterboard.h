@@ -94,33 +94,94 @@ typedef enum {
     LED_BEHAVIOR_TIMED = 3,
 } led_behavior_e;
 
-typedef double (*sensorfunc)(void);
+/* rate groups, in the order the main loop services them; the control
+ * group is run from the clock 1 interrupt instead */
+typedef enum {
+    SCHED_GROUP_CONTROL = 0,       /* 10kHz: sensors, controllers, motors */
+    SCHED_GROUP_SUPERVISE = 1,     /* 1kHz: supervision and debug output */
+    SCHED_GROUP_HOUSEKEEPING = 2,  /* 100Hz: LEDs */
+    SCHED_GROUP_COUNT = 3,
+} sched_group_e;
+
+/* sensors report plain integers in their own units (encoder counts,
+ * ADC counts, ...); the controller's target is in the same units */
+typedef int32_t (*sensorfunc)(void);
+
+/* the sensor functions the board provides, by sensor channel */
+typedef enum {
+    SENSOR_ENCODER_A = 0,          /* position, counts */
+    SENSOR_ENCODER_B = 1,
+    SENSOR_ENCODER_A_VELOCITY = 2, /* counts per second */
+    SENSOR_ENCODER_B_VELOCITY = 3,
+    SENSOR_ANALOG_1 = 4,           /* 12-bit ADC counts */
+    SENSOR_ANALOG_2 = 5,
+    SENSOR_ANALOG_3 = 6,
+    SENSOR_ANALOG_4 = 7,
+    SENSOR_ANALOG_5 = 8,
+    SENSOR_ANALOG_6 = 9,
+} sensor_e;
 
 
 /////////////////////////////////////////
 // declarations you care about
 
-/* stores PID settings and other controller state */
-typedef struct {
-    double P;
-    double I;
-    double D;
-    double e_last;
-    double e_cur;
-    double e_int;
-    double target;
-} controller_t;
+/* controller_t (PID settings and other controller state) lives in
+ * pid.h, motion_t (the trajectory generator) in motion.h, path_t
+ * (the waypoint interpolator) in path.h, output_t (the output
+ * stage) in output.h and current_t (the inner current loop) in
+ * current.h */
 
 /* stores motor configuration, state, and data */
 typedef struct {
     uint8_t sensorchan;
     uint8_t closed;
-    uint16_t duty;              /* range is 0-1000 */
-    uint16_t duty_count;
-    uint8_t direction;
+    int32_t command;            /* signed duty, fraction of 0x10000 */
+    output_t output;
+    uint8_t cascade;            /* I2C_CASCADE_* */
+    uint8_t vel_sensor;
+    uint8_t outer_div;          /* ticks between updates of each stage */
+    uint8_t vel_div;
+    uint8_t outer_tick;
+    uint8_t vel_tick;
+    int32_t outer_out;          /* held between updates */
+    int32_t vel_out;
+    controller_t vel;           /* velocity stage of a cascade */
+    current_t current;          /* inner current loop */
+    uint16_t out_duty;          /* what the bridge was last given */
+    uint16_t out_residue;       /* duty the last compare fell short by */
+    uint16_t out_compare;
+    uint8_t out_pins;           /* MOTOR_PINS_* */
+    int32_t measured;           /* sensor reading this tick */
+    uint8_t target_shift;       /* compact commands' scaling */
+    uint8_t gain_shift;
+    int32_t target_base;
+    int32_t staged_target;      /* applied by the next latch */
+    volatile uint8_t staged;
     controller_t cont;
+    motion_t motion;
+    path_t path;
 } motor_channel_t;
 
+/* A channel's control state as of the end of a tick. The tick
+ * publishes both channels' once per tick into whichever of two copies
+ * isn't current, then flips to it and bumps a sequence count; readers
+ * in the main loop take motor_snapshot() instead of reading the
+ * channel, so a value is never half from one tick and half from the
+ * next, and the tick never waits. The TWI interrupt doesn't read it:
+ * what it sends is worked out from it in the main loop beforehand,
+ * see do_stage() and regmap_refresh(). */
+typedef struct {
+    int32_t target;
+    int32_t measured;
+    int32_t error;
+    int32_t drive;              /* signed duty, after the output stage */
+    uint16_t path_dry;
+    uint32_t motion_left;       /* ticks, motion_remaining() */
+    uint32_t path_left;         /* ticks, path_running() */
+    int32_t moved;              /* quadrature counts, last ENCODER_WINDOW ticks */
+    uint16_t tick;              /* sched_ticks when taken */
+} motor_snap_t;
+
 /* stores LED configuration and state */
 typedef struct {
     led_behavior_e behavior;
@@ -137,21 +198,23 @@ typedef struct {
 
 /* these are for controlling LEDs. In OFF or ON mode, the LED will
  * just be on or off. In timed mode, set .time to the number of calls
- * to do_leds() to turn the specified LED on for. do_leds is by called
- * in the ISR for clock 1, which ticks at 10kHz, so the default is
- * that the led will light for .time/10 milliseconds. */
+ * to do_leds() to turn the specified LED on for. do_leds is run in
+ * the 100Hz housekeeping rate group, so the led will light for
+ * .time*10 milliseconds. */
+
+extern led_t* led_power;
+extern led_t* led_orders;
+extern led_t* led_error1;
+extern led_t* led_error2;
+extern led_t* led_mota;
+extern led_t* led_motb;
 
-led_t* led_power;
-led_t* led_orders;
-led_t* led_error1;
-led_t* led_error2;
-led_t* led_mota;
-led_t* led_motb;
+extern sensorfunc sensor_functions[16];
 
-sensorfunc sensor_functions[16];
+extern motor_channel_t motA;
+extern motor_channel_t motB;
 
-motor_channel_t motA;
-motor_channel_t motB;
+extern rategroup_t sched_groups[SCHED_GROUP_COUNT];
 
 
 
@@ -167,12 +230,36 @@ void init_clock(void);
 void init_sensors(void);
 void init_motors(void);
 
+void motor_set_mode(motor_channel_t* mot, uint8_t mode);
+void motor_set_pwm_mode(uint8_t mode);
+void motor_set_cascade(motor_channel_t* mot, uint8_t cascade, uint8_t input,
+                       uint8_t vel_sensor, uint8_t outer_div,
+                       uint8_t vel_div, uint16_t limit);
+void motor_set_target(motor_channel_t* mot, int32_t target);
+void motor_move(motor_channel_t* mot, int32_t target);
+void motor_stage_target(motor_channel_t* mot, int32_t target);
+int32_t motor_compact_target(motor_channel_t* mot, register8_t* buf);
+fix_t motor_compact_gain(motor_channel_t* mot, register8_t* buf);
+void motor_snapshot(const motor_channel_t* mot, motor_snap_t* snap);
+
 void do_sensors(void);
 void do_motors(void);
 void do_leds(void);
+void do_digout(void);
+void do_stage(void);
+void do_address(void);
 
 /////////////////////////////////////////
 // util functions
 void TWIC_SlaveProcessData(void);
-
+uint16_t read_u16(register8_t* buf);
+uint32_t read_u32(register8_t* buf);
+void write_u16(register8_t* buf, uint16_t val);
+void write_u32(register8_t* buf, uint32_t val);
+uint16_t ticks_to_ms(uint32_t ticks);
+
+void init_board(void);
+void do_mainloop(void);
+#ifndef HAL_HOST
 int main(void);
+#endif
@@ -0,0 +1,61 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+
+#include "fixed.h"
+#include "encoder.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Encoders
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* start counting from zero at whatever the hardware says now */
+void encoder_init(encoder_t* enc, uint16_t count)
+{
+    uint8_t i;
+
+    enc->position = 0;
+    enc->last = count;
+    enc->idx = 0;
+    for (i = 0; i < ENCODER_WINDOW; i++)
+        enc->history[i] = 0;
+}
+
+void encoder_update(encoder_t* enc, uint16_t count)
+{
+    enc->position += (int16_t)(count - enc->last);
+    enc->last = count;
+    enc->history[enc->idx] = enc->position;
+    enc->idx = (enc->idx + 1) & (ENCODER_WINDOW - 1);
+}
+
+/* counts per second over the last ENCODER_WINDOW ticks; the oldest
+ * entry is the one about to be overwritten */
+int32_t encoder_velocity(const encoder_t* enc, uint16_t rate)
+{
+    int32_t moved = enc->position - enc->history[enc->idx];
+    return fix_sat(((int64_t)moved * rate) / ENCODER_WINDOW);
+}
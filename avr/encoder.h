@@ -0,0 +1,55 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Extends a quadrature decoder's 16-bit hardware count to a 32-bit
+ * position. encoder_update() is called once per control tick and adds
+ * the signed difference since the last tick, so the count can wrap
+ * either way any number of times as long as it moves less than 32767
+ * counts per tick. It also keeps the last ENCODER_WINDOW positions for
+ * a velocity estimate that isn't quantized to whole counts per tick. */
+
+#define ENCODER_WINDOW 16       /* ticks, a power of two */
+
+typedef struct {
+    int32_t position;
+    uint16_t last;
+    uint8_t idx;
+    int32_t history[ENCODER_WINDOW];
+} encoder_t;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void encoder_init(encoder_t* enc, uint16_t count);
+void encoder_update(encoder_t* enc, uint16_t count);
+int32_t encoder_velocity(const encoder_t* enc, uint16_t rate);
+
+#endif /* ENCODER_H */
@@ -0,0 +1,147 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Fixed-point arithmetic
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* The xmega has no FPU, so anything that runs in the control loop is
+ * done in fixed point. A fix_t is a signed 32-bit value with a
+ * caller-chosen number of fractional bits; FIX_Q16 (Q16.16) and
+ * FIX_Q24 (Q8.24) are the two formats the controllers use. Every
+ * operation here saturates instead of wrapping, because a wrapped
+ * controller output flips the motor direction at full power. */
+
+typedef int32_t fix_t;
+
+#define FIX_Q16 16
+#define FIX_Q24 24
+
+#define FIX_MAX ((fix_t)INT32_MAX)
+#define FIX_MIN ((fix_t)INT32_MIN)
+
+#define FIX_ONE(q) ((fix_t)1 << (q))
+
+/* clamp a 64-bit intermediate into 32 bits */
+static inline fix_t fix_sat(int64_t x)
+{
+    if (x > FIX_MAX) return FIX_MAX;
+    if (x < FIX_MIN) return FIX_MIN;
+    return (fix_t)x;
+}
+
+static inline fix_t fix_clamp(fix_t x, fix_t lo, fix_t hi)
+{
+    if (x > hi) return hi;
+    if (x < lo) return lo;
+    return x;
+}
+
+/* saturating a + b */
+static inline fix_t fix_add(fix_t a, fix_t b)
+{
+    fix_t r = (fix_t)((uint32_t)a + (uint32_t)b);
+    /* overflow iff a and b have the same sign and r doesn't */
+    if (((a ^ r) & (b ^ r)) < 0)
+        r = (a < 0) ? FIX_MIN : FIX_MAX;
+    return r;
+}
+
+/* saturating a - b */
+static inline fix_t fix_sub(fix_t a, fix_t b)
+{
+    fix_t r = (fix_t)((uint32_t)a - (uint32_t)b);
+    /* overflow iff a and b have different signs and r's sign isn't a's */
+    if (((a ^ b) & (a ^ r)) < 0)
+        r = (a < 0) ? FIX_MIN : FIX_MAX;
+    return r;
+}
+
+/* multiply a value with q fractional bits by a plain integer (or two
+ * values whose fractional bits add up to q), giving a result with the
+ * fractional bits of the other operand. The product is kept in 64 bits
+ * so this never overflows before the shift. */
+static inline int64_t fix_mul_wide(fix_t a, fix_t b, uint8_t q)
+{
+    return ((int64_t)a * b) >> q;
+}
+
+static inline fix_t fix_mul(fix_t a, fix_t b, uint8_t q)
+{
+    return fix_sat(fix_mul_wide(a, b, q));
+}
+
+/* a * b for a 32-bit a and a 16-bit b, exactly, for the control loop.
+ * The product fits in 48 bits. It's done as two 16x16 bit multiplies
+ * into 32 bits, which the xmega's hardware multiplier does in a few
+ * instructions each, where a 64-bit multiply is a long library call;
+ * putting the halves together only takes a shift by 16, which is
+ * moving bytes. */
+static inline int64_t fix_mul_32x16(fix_t a, int16_t b)
+{
+    int32_t lo = (int32_t)(uint16_t)a * b;
+    int32_t hi = (int32_t)(int16_t)(a >> 16) * b;
+    return ((int64_t)hi << 16) + lo;
+}
+
+/* convert between fractional formats, saturating on the way up */
+static inline fix_t fix_requant(fix_t x, uint8_t from_q, uint8_t to_q)
+{
+    if (to_q >= from_q)
+        return fix_sat((int64_t)x << (to_q - from_q));
+    return x >> (from_q - to_q);
+}
+
+/* Convert the raw bits of an IEEE754 single into a fix_t with q
+ * fractional bits, rounding toward zero and saturating. This is how
+ * float-valued I2C parameters get in without linking soft-float. */
+static inline fix_t fix_from_float_bits(uint32_t bits, uint8_t q)
+{
+    uint8_t sign = bits >> 31;
+    int16_t exp = (int16_t)((bits >> 23) & 0xff);
+    uint32_t mant = bits & 0x007fffff;
+    int16_t shift;
+    int64_t mag;
+
+    if (exp == 0)               /* zero and denormals */
+        return 0;
+    if (exp == 0xff)            /* inf and nan */
+        return sign ? FIX_MIN : FIX_MAX;
+
+    mant |= 0x00800000;
+    /* value = mant * 2^(exp - 127 - 23), we want value * 2^q */
+    shift = exp - 127 - 23 + q;
+    if (shift >= 40)
+        mag = INT64_MAX;
+    else if (shift >= 0)
+        mag = (int64_t)mant << shift;
+    else if (shift > -32)
+        mag = mant >> -shift;
+    else
+        mag = 0;
+
+    return fix_sat(sign ? -mag : mag);
+}
+
+#endif /* FIXED_H */
@@ -0,0 +1,142 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Hardware abstraction layer
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* A thin layer between the firmware and the xmega's peripherals, so
+ * the same control, decode and LED logic can be built for the board
+ * or as a Linux executable (make host). Each backend provides the same
+ * set of calls:
+ *
+ *   hal_port_t, HAL_PORTA..HAL_PORTE, HAL_PORTR
+ *   hal_gpio_output(port, mask)       make pins outputs
+ *   hal_gpio_pullup(port, mask)       enable pullups on pins
+ *   hal_gpio_set(port, mask)          drive pins high
+ *   hal_gpio_clr(port, mask)          drive pins low
+ *   hal_gpio_write(port, mask, on)    drive pins high or low
+ *   hal_gpio_read(port)               read input levels
+ *
+ *   hal_clock_init()                  32MHz system clock
+ *   hal_irq_enable(level)             enable an interrupt level
+ *   hal_irq_hold(level)               hold off that level and those
+ *                                     below it; returns what to give
+ *   hal_irq_restore(held)             back
+ *
+ *   hal_tick_init(period, level)      control clock: F_CPU/2, with an
+ *                                     overflow interrupt every period+1
+ *   hal_tick_count()                  where in the period we are
+ *   hal_tick_pending()                has the next overflow already come
+ *
+ *   hal_pwm_init(period)              motor PWM clock: F_CPU/2, single
+ *                                     slope on outputs A and B, no
+ *                                     interrupt
+ *   hal_pwm_period(period)            buffered period, taken up with
+ *                                     the compares
+ *   hal_pwm_set(channel, compare)     buffered compare value, taken up
+ *                                     at the start of the next period
+ *   hal_pwm_pending(channel)          has the last compare written not
+ *                                     been taken up yet
+ *
+ *   hal_twi_slave_init(twi, addr, process, level)
+ *
+ *   hal_qdec_init(channel)            quadrature decoder on an encoder
+ *                                     header, counting with no CPU
+ *   hal_qdec_count(channel)           16-bit count, wraps
+ *
+ *   hal_adc_init(phase, level)        12-bit, single-ended, started
+ *                                     at phase into the PWM period
+ *                                     while armed
+ *   hal_adc_phase(phase)              move the trigger, from the next
+ *                                     PWM period
+ *   hal_adc_arm()                     let the PWM timer start the
+ *   hal_adc_disarm()                  next conversion, or not
+ *   hal_adc_select(pin)               input for the next conversion
+ *   hal_adc_start()                   start a conversion now
+ *   hal_adc_result()                  the conversion just completed
+ *
+ *   hal_wdt_enable()                  ~0.5s watchdog
+ *   hal_wdt_reset()
+ *
+ *   hal_unique_id(id)                 HAL_UNIQUE_ID_BYTES that no
+ *                                     other chip has
+ *   hal_eeprom_read(addr)             a byte of EEPROM
+ *   hal_eeprom_write(addr, data)      write a byte if it differs;
+ *                                     slow, main loop only
+ *
+ * and the interrupt vector names HAL_TICK_vect, HAL_TWI_vect and
+ * HAL_ADC_vect for use with ISR(). Everything is static inline on the
+ * xmega, so the layer costs nothing on the board. */
+
+/* interrupt levels, as used by PMIC */
+#define HAL_INTLVL_OFF 0
+#define HAL_INTLVL_LO  1
+#define HAL_INTLVL_MED 2
+#define HAL_INTLVL_HI  3
+
+/* The interrupt plan. TWI is alone at HI and keeps its handler short,
+ * so a byte is serviced within about 20us whatever the control
+ * loop is doing and the bus is never stretched for long. The control
+ * tick and the ADC are at MED, and LO is free for anything that can
+ * wait; the PWM runs without an interrupt at all. Main loop code that
+ * only shares state with the control interrupts holds off MED and LO
+ * with HAL_ENTER_CONTROL_REGION rather than turning off interrupts
+ * altogether; the few things shared with the TWI interrupt still use
+ * AVR_ENTER_CRITICAL_REGION and are kept to a handful of cycles.
+ *
+ * The TWI interrupt can now run in the middle of the control tick, so
+ * whatever it reads from the tick's state has to be a single byte,
+ * double buffered (the register status copy, the analog results) or
+ * written by the tick with interrupts off. */
+#define HAL_ENTER_CONTROL_REGION() uint8_t hal_held = hal_irq_hold(HAL_INTLVL_MED)
+#define HAL_LEAVE_CONTROL_REGION() hal_irq_restore(hal_held)
+
+/* lot number, wafer number and die coordinates */
+#define HAL_UNIQUE_ID_BYTES 11
+
+/* PWM outputs */
+typedef enum {
+    HAL_PWM_A = 0,
+    HAL_PWM_B = 1,
+} hal_pwm_e;
+
+/* quadrature decoders, one per motor */
+typedef enum {
+    HAL_QDEC_A = 0,
+    HAL_QDEC_B = 1,
+    HAL_QDEC_COUNT = 2,
+} hal_qdec_e;
+
+#include "avr_compiler.h"
+#include "twi/twi_slave_driver.h"
+
+#ifdef HAL_HOST
+#include "hal/hal_host.h"
+#else
+#include "hal/hal_xmega.h"
+#endif
+
+#endif /* HAL_H */
@@ -0,0 +1,396 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "hal/hal.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// State
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+uint8_t hal_host_sreg = 0;
+TWI_t TWIC;
+
+hal_host_port_t hal_host_ports[6];
+uint64_t hal_host_time = 0;
+
+uint8_t hal_host_irq_levels = 0;
+uint16_t hal_host_tick_period = 0;
+uint8_t hal_host_tick_level = HAL_INTLVL_OFF;
+uint16_t hal_host_pwm_period = 0;
+uint16_t hal_host_pwm_compare[2];
+uint16_t hal_host_pwm_buffer[2];
+uint16_t hal_host_pwm_period_buffer;
+uint8_t hal_host_pwm_pending = 0;
+uint64_t hal_host_pwm_start = 0;
+uint16_t hal_host_adc[12];
+uint8_t hal_host_adc_level = HAL_INTLVL_OFF;
+bool hal_host_adc_armed = false;
+uint8_t hal_host_adc_mux;
+bool hal_host_adc_pending;
+uint16_t hal_host_adc_result;
+uint32_t hal_host_adc_conversions;
+bool hal_host_qdec_enabled[HAL_QDEC_COUNT];
+uint16_t hal_host_qdec_count[HAL_QDEC_COUNT];
+bool hal_host_wdt_enabled = false;
+uint32_t hal_host_wdt_resets = 0;
+uint8_t hal_host_unique_id[HAL_UNIQUE_ID_BYTES];
+uint8_t hal_host_eeprom[HAL_HOST_EEPROM_BYTES] = {
+    [0 ... HAL_HOST_EEPROM_BYTES - 1] = 0xff
+};
+
+void (*hal_host_advance)(uint64_t from, uint64_t to) = 0;
+void (*hal_host_tick)(void) = 0;
+
+static uint64_t pwm_next = 0;
+static uint16_t adc_phase = 0;
+static uint64_t adc_next = 0;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Virtual time
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* would an interrupt configured at this level be taken right now */
+static bool irq_deliverable(uint8_t level)
+{
+    if (level == HAL_INTLVL_OFF)
+        return false;
+    if (!(hal_host_sreg & CPU_I_bm))
+        return false;
+    return hal_host_irq_levels & (1 << (level - 1));
+}
+
+/* the first time at or after t that the PWM counter is at phase */
+static uint64_t next_at_phase(uint64_t t, uint16_t phase)
+{
+    uint32_t len = (uint32_t)hal_host_pwm_period + 1;
+    uint64_t at = t - t % len + phase;
+    return at < t ? at + len : at;
+}
+
+/* the update at the bottom of the PWM period: buffered compares and
+ * period become the ones the timer runs on, and the ADC trigger comes
+ * round again at phase into the new period */
+static void pwm_update(void)
+{
+    uint8_t ch;
+
+    for (ch = 0; ch < 2; ch++)
+        if (hal_host_pwm_pending & (1 << ch))
+            hal_host_pwm_compare[ch] = hal_host_pwm_buffer[ch];
+    if (hal_host_pwm_pending & HAL_HOST_PWM_PERIOD_PENDING)
+        hal_host_pwm_period = hal_host_pwm_period_buffer;
+    hal_host_pwm_pending = 0;
+
+    hal_host_pwm_start = hal_host_time;
+    adc_next = hal_host_time + adc_phase;
+}
+
+void hal_adc_init(uint16_t phase, uint8_t level)
+{
+    adc_phase = phase;
+    adc_next = next_at_phase(hal_host_time, phase);
+    hal_host_adc_level = level;
+}
+
+/* the next update starts the period at the new phase */
+void hal_adc_phase(uint16_t phase)
+{
+    adc_phase = phase;
+}
+
+/* run conversions for as long as the interrupt keeps starting them */
+static void adc_convert(void)
+{
+    while (hal_host_adc_pending && irq_deliverable(hal_host_adc_level))
+    {
+        hal_host_adc_pending = false;
+        hal_host_adc_result = hal_host_adc[hal_host_adc_mux & 0x0f];
+        hal_host_adc_conversions++;
+        hal_host_adc_isr();
+    }
+}
+
+/* move virtual time forward, letting the plant model catch up */
+static void advance_to(uint64_t t)
+{
+    if (hal_host_advance && t > hal_host_time)
+        hal_host_advance(hal_host_time, t);
+    hal_host_time = t;
+}
+
+/* Advance virtual time by ticks control periods. The PWM updates
+ * and ADC triggers that fall inside each period are delivered first,
+ * in order, then the control overflow at the end of the period, then
+ * idle() gets one pass, which is normally the firmware's main loop
+ * body. */
+void hal_host_run(uint32_t ticks, void (*idle)(void))
+{
+    uint32_t tick_len = (uint32_t)hal_host_tick_period + 1;
+
+    while (ticks--)
+    {
+        uint64_t end = hal_host_time + tick_len;
+
+        while (hal_host_pwm_period)
+        {
+            bool pwm = pwm_next <= end;
+            bool adc = hal_host_adc_level != HAL_INTLVL_OFF && adc_next <= end;
+
+            if (pwm && (!adc || pwm_next <= adc_next))
+            {
+                advance_to(pwm_next);
+                pwm_update();
+                pwm_next += (uint32_t)hal_host_pwm_period + 1;
+            }
+            else if (adc)
+            {
+                advance_to(adc_next);
+                if (hal_host_adc_armed)
+                {
+                    hal_host_adc_pending = true;
+                    adc_convert();
+                }
+                adc_next = UINT64_MAX;
+            }
+            else
+                break;
+        }
+
+        advance_to(end);
+        if (hal_host_tick)
+            hal_host_tick();
+        if (hal_host_tick_period && irq_deliverable(hal_host_tick_level))
+            hal_host_tick_isr();
+        adc_convert();
+
+        if (idle)
+            idle();
+    }
+}
+
+/* back to time zero with both timers at the bottom, so a run doesn't
+ * depend on what ran before it */
+void hal_host_reset_time(void)
+{
+    hal_host_time = 0;
+    hal_host_pwm_start = 0;
+    pwm_next = 0;
+    adc_next = adc_phase;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Encoders
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* An encoder turning drives its two phase pins through the gray code
+ * 00 10 11 01 (phase A leading is forward) and the decoder counts
+ * each edge from the pin levels before and after it, the way the
+ * xmega's does: +1 or -1 for a valid step, nothing if both phases
+ * changed at once. Counts are single edges, four per encoder line. */
+
+static const uint8_t qdec_gray[4] = { 0x0, PIN2_bm, PIN2_bm | PIN3_bm, PIN3_bm };
+
+/* indexed by (old phases << 2 | new phases), phases as A | B << 1 */
+static const int8_t qdec_step[16] = {
+     0, +1, -1,  0,
+    -1,  0,  0, +1,
+    +1,  0,  0, -1,
+     0, -1, +1,  0,
+};
+
+static uint8_t qdec_phase[HAL_QDEC_COUNT];
+
+/* the phases as the decoder sees them: a pin the firmware has made an
+ * output reads back what it drives, whatever the encoder does */
+static uint8_t qdec_levels(const hal_host_port_t* port)
+{
+    uint8_t pins = (port->in & ~port->dir) | (port->out & port->dir);
+
+    return ((pins & PIN2_bm) ? 1 : 0) | ((pins & PIN3_bm) ? 2 : 0);
+}
+
+/* turn an encoder by counts edges */
+void hal_host_qdec_move(hal_qdec_e channel, int32_t counts)
+{
+    hal_host_port_t* port = &hal_host_ports[channel == HAL_QDEC_A ? 0 : 1];
+
+    while (counts != 0)
+    {
+        uint8_t before = qdec_levels(port);
+        uint8_t after;
+
+        qdec_phase[channel] = (qdec_phase[channel] + (counts > 0 ? 1 : 3)) & 3;
+        port->in = (port->in & ~(PIN2_bm | PIN3_bm)) | qdec_gray[qdec_phase[channel]];
+        after = qdec_levels(port);
+
+        if (hal_host_qdec_enabled[channel])
+            hal_host_qdec_count[channel] += qdec_step[before << 2 | after];
+        counts += counts > 0 ? -1 : 1;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// I2C master
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* The slave registers are poked the way the TWI hardware would, then
+ * the slave interrupt runs. CTRLB is cleared first so we can see what
+ * the driver told the hardware to do. A slave whose interrupt level
+ * isn't enabled simply doesn't answer. */
+
+static bool twi_reading;
+
+static void twi_event(uint8_t status)
+{
+    TWIC.SLAVE.STATUS = status | (twi_reading ? TWI_SLAVE_DIR_bm : 0);
+    TWIC.SLAVE.CTRLB = 0;
+    hal_host_twi_isr();
+}
+
+static bool twi_acked(void)
+{
+    return ((TWIC.SLAVE.CTRLB & TWI_SLAVE_CMD_gm) == TWI_SLAVE_CMD_RESPONSE_gc)
+        && !(TWIC.SLAVE.CTRLB & TWI_SLAVE_ACKACT_bm);
+}
+
+/* does the slave answer this address; with ADDREN set the mask
+ * register is a second address, with it clear it's a mask of address
+ * bits that don't have to match */
+static bool twi_matches(uint8_t address)
+{
+    uint8_t addr = TWIC.SLAVE.ADDR >> 1;
+    uint8_t mask = TWIC.SLAVE.ADDRMASK >> 1;
+
+    if (address == 0 && (TWIC.SLAVE.ADDR & 0x01))
+        return true;
+    if (TWIC.SLAVE.ADDRMASK & TWI_SLAVE_ADDREN_bm)
+        return address == addr || address == mask;
+    return !((address ^ addr) & ~mask & 0x7f);
+}
+
+/* start (or repeated start) and address; returns whether the slave
+ * acknowledged */
+bool hal_host_twi_start(uint8_t address, bool read)
+{
+    uint8_t level = (TWIC.SLAVE.CTRLA >> TWI_SLAVE_INTLVL_gp) & 0x03;
+
+    if (!(TWIC.SLAVE.CTRLA & TWI_SLAVE_ENABLE_bm) || !irq_deliverable(level))
+        return false;
+    if (!twi_matches(address))
+        return false;
+
+    twi_reading = read;
+    TWIC.SLAVE.DATA = (address << 1) | (read ? 1 : 0);
+    twi_event(TWI_SLAVE_APIF_bm | TWI_SLAVE_AP_bm);
+    return twi_acked();
+}
+
+/* master writes one byte; returns whether the slave acknowledged */
+bool hal_host_twi_send(uint8_t data)
+{
+    TWIC.SLAVE.DATA = data;
+    twi_event(TWI_SLAVE_DIF_bm);
+    return twi_acked();
+}
+
+/* master reads one byte; last is the master NACKing it */
+uint8_t hal_host_twi_recv(bool last)
+{
+    uint8_t data = hal_host_twi_load();
+
+    if (last)
+        hal_host_twi_nack();
+    return data;
+}
+
+/* The halves of a read, for a harness with several slaves on the bus:
+ * what the slave puts on the bus for the next byte, and the master
+ * NACKing it. */
+uint8_t hal_host_twi_load(void)
+{
+    twi_event(TWI_SLAVE_DIF_bm);
+    return TWIC.SLAVE.DATA;
+}
+
+void hal_host_twi_nack(void)
+{
+    twi_event(TWI_SLAVE_DIF_bm | TWI_SLAVE_RXACK_bm);
+}
+
+/* another slave drove a 0 where this one sent a 1; it lets go of the
+ * bus until the next start */
+void hal_host_twi_collision(void)
+{
+    twi_event(TWI_SLAVE_COLL_bm);
+    twi_reading = false;
+}
+
+void hal_host_twi_stop(void)
+{
+    /* the driver only asks for a stop interrupt while receiving */
+    if (TWIC.SLAVE.CTRLA & TWI_SLAVE_PIEN_bm)
+        twi_event(TWI_SLAVE_APIF_bm);
+    twi_reading = false;
+}
+
+/* Whole transactions. Both return the number of data bytes transferred
+ * before the slave NACKed, or -1 if it didn't answer its address. */
+int hal_host_twi_write(uint8_t address, const uint8_t* data, uint8_t len)
+{
+    int sent = 0;
+
+    if (!hal_host_twi_start(address, false))
+        return -1;
+    while (sent < len)
+    {
+        bool ack = hal_host_twi_send(data[sent]);
+        sent++;
+        if (!ack)
+            break;
+    }
+    hal_host_twi_stop();
+    return sent;
+}
+
+int hal_host_twi_read(uint8_t address, uint8_t* data, uint8_t len)
+{
+    uint8_t i;
+
+    if (!hal_host_twi_start(address, true))
+        return -1;
+    for (i = 0; i < len; i++)
+        data[i] = hal_host_twi_recv(i == len - 1);
+    hal_host_twi_stop();
+    return len;
+}
@@ -0,0 +1,328 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Host backend
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Peripherals are plain variables, and time is virtual: nothing
+ * happens until the harness calls hal_host_run(), which advances the
+ * control clock one period at a time, takes up buffered PWM compares
+ * at each PWM period start and delivers the interrupts when they come
+ * due. The harness plays I2C master with
+ * the hal_host_twi_* calls, which drive the real TWI slave driver
+ * through a model of its registers. */
+
+#define HAL_TICK_vect hal_host_tick_isr
+#define HAL_TWI_vect hal_host_twi_isr
+#define HAL_ADC_vect hal_host_adc_isr
+
+void hal_host_tick_isr(void);
+void hal_host_twi_isr(void);
+void hal_host_adc_isr(void);
+
+/////////////////////////////////////////
+// state
+
+typedef struct {
+    uint8_t dir;
+    uint8_t out;
+    uint8_t in;
+    uint8_t pullup;
+} hal_host_port_t;
+
+extern hal_host_port_t hal_host_ports[6];
+
+/* virtual time, in control clock ticks (F_CPU/2) */
+extern uint64_t hal_host_time;
+
+extern uint8_t hal_host_irq_levels;
+extern uint16_t hal_host_tick_period;
+extern uint8_t hal_host_tick_level;
+extern uint16_t hal_host_pwm_period;
+/* compare[] is what the outputs are running on, buffer[] what was
+ * last written, and bit n of pending is set until channel n's buffer
+ * is taken up; HAL_HOST_PWM_PERIOD_PENDING is the same for the period.
+ * pwm_start is when the period now running began. */
+#define HAL_HOST_PWM_PERIOD_PENDING (1 << 2)
+extern uint16_t hal_host_pwm_compare[2];
+extern uint16_t hal_host_pwm_buffer[2];
+extern uint16_t hal_host_pwm_period_buffer;
+extern uint8_t hal_host_pwm_pending;
+extern uint64_t hal_host_pwm_start;
+extern uint16_t hal_host_adc[12];
+extern uint8_t hal_host_adc_level;
+extern bool hal_host_adc_armed;
+extern uint8_t hal_host_adc_mux;
+extern bool hal_host_adc_pending;
+extern uint16_t hal_host_adc_result;
+extern uint32_t hal_host_adc_conversions;
+extern bool hal_host_qdec_enabled[HAL_QDEC_COUNT];
+extern uint16_t hal_host_qdec_count[HAL_QDEC_COUNT];
+extern bool hal_host_wdt_enabled;
+extern uint32_t hal_host_wdt_resets;
+
+/* the signature row and EEPROM; EEPROM starts erased */
+#define HAL_HOST_EEPROM_BYTES 512
+extern uint8_t hal_host_unique_id[HAL_UNIQUE_ID_BYTES];
+extern uint8_t hal_host_eeprom[HAL_HOST_EEPROM_BYTES];
+
+/////////////////////////////////////////
+// GPIO
+
+typedef hal_host_port_t* hal_port_t;
+
+#define HAL_PORTA (&hal_host_ports[0])
+#define HAL_PORTB (&hal_host_ports[1])
+#define HAL_PORTC (&hal_host_ports[2])
+#define HAL_PORTD (&hal_host_ports[3])
+#define HAL_PORTE (&hal_host_ports[4])
+#define HAL_PORTR (&hal_host_ports[5])
+
+static inline void hal_gpio_output(hal_port_t port, uint8_t mask)
+{
+    port->dir |= mask;
+}
+
+static inline void hal_gpio_pullup(hal_port_t port, uint8_t mask)
+{
+    port->pullup |= mask;
+}
+
+static inline void hal_gpio_set(hal_port_t port, uint8_t mask)
+{
+    port->out |= mask;
+}
+
+static inline void hal_gpio_clr(hal_port_t port, uint8_t mask)
+{
+    port->out &= ~mask;
+}
+
+static inline void hal_gpio_write(hal_port_t port, uint8_t mask, bool on)
+{
+    if (on)
+        port->out |= mask;
+    else
+        port->out &= ~mask;
+}
+
+static inline uint8_t hal_gpio_read(hal_port_t port)
+{
+    return port->in;
+}
+
+/////////////////////////////////////////
+// clock and interrupts
+
+static inline void hal_clock_init(void)
+{
+}
+
+static inline void hal_irq_enable(uint8_t level)
+{
+    hal_host_irq_levels |= (1 << (level - 1));
+}
+
+static inline uint8_t hal_irq_hold(uint8_t level)
+{
+    uint8_t held = hal_host_irq_levels;
+
+    hal_host_irq_levels = held & ~((1 << level) - 1);
+    return held;
+}
+
+static inline void hal_irq_restore(uint8_t held)
+{
+    hal_host_irq_levels = held;
+}
+
+/////////////////////////////////////////
+// control clock
+
+static inline void hal_tick_init(uint16_t period, uint8_t level)
+{
+    hal_host_tick_period = period;
+    hal_host_tick_level = level;
+}
+
+static inline uint16_t hal_tick_count(void)
+{
+    return hal_host_time % ((uint32_t)hal_host_tick_period + 1);
+}
+
+static inline bool hal_tick_pending(void)
+{
+    return false;
+}
+
+/////////////////////////////////////////
+// motor PWM
+
+static inline void hal_pwm_init(uint16_t period)
+{
+    hal_host_pwm_period = period;
+}
+
+static inline void hal_pwm_set(hal_pwm_e channel, uint16_t compare)
+{
+    hal_host_pwm_buffer[channel] = compare;
+    hal_host_pwm_pending |= 1 << channel;
+}
+
+static inline void hal_pwm_period(uint16_t period)
+{
+    hal_host_pwm_period_buffer = period;
+    hal_host_pwm_pending |= HAL_HOST_PWM_PERIOD_PENDING;
+}
+
+static inline bool hal_pwm_pending(hal_pwm_e channel)
+{
+    return hal_host_pwm_pending & (1 << channel);
+}
+
+/////////////////////////////////////////
+// TWI slave
+
+static inline void hal_twi_slave_init(TWI_Slave_t* twi, uint8_t address,
+                                      void (*process)(void), uint8_t level)
+{
+    TWI_SlaveInitializeDriver(twi, &TWIC, process);
+    TWI_SlaveInitializeModule(twi, address, (TWI_SLAVE_INTLVL_t)(level << TWI_SLAVE_INTLVL_gp));
+}
+
+/////////////////////////////////////////
+// quadrature decoders
+
+/* the encoder pins are inputs; the decoder counts whatever
+ * hal_host_qdec_move() does to them */
+static inline void hal_qdec_init(hal_qdec_e channel)
+{
+    hal_host_ports[channel == HAL_QDEC_A ? 0 : 1].dir &= ~(PIN2_bm | PIN3_bm);
+    hal_host_qdec_enabled[channel] = true;
+}
+
+static inline uint16_t hal_qdec_count(hal_qdec_e channel)
+{
+    return hal_host_qdec_count[channel];
+}
+
+/////////////////////////////////////////
+// ADC
+
+/* hal_host_run() starts a conversion at phase in every PWM period
+ * while armed;
+ * conversions take no virtual time, and the result is whatever
+ * hal_host_adc[] held for the selected pin at the moment it ran */
+void hal_adc_init(uint16_t phase, uint8_t level);
+void hal_adc_phase(uint16_t phase);
+
+static inline void hal_adc_select(uint8_t pin)
+{
+    hal_host_adc_mux = pin;
+}
+
+static inline void hal_adc_arm(void)
+{
+    hal_host_adc_armed = true;
+}
+
+static inline void hal_adc_disarm(void)
+{
+    hal_host_adc_armed = false;
+}
+
+static inline void hal_adc_start(void)
+{
+    hal_host_adc_pending = true;
+}
+
+static inline uint16_t hal_adc_result(void)
+{
+    return hal_host_adc_result;
+}
+
+/////////////////////////////////////////
+// watchdog
+
+static inline void hal_wdt_enable(void)
+{
+    hal_host_wdt_enabled = true;
+}
+
+static inline void hal_wdt_reset(void)
+{
+    hal_host_wdt_resets++;
+}
+
+/////////////////////////////////////////
+// identity and EEPROM
+
+static inline void hal_unique_id(uint8_t* id)
+{
+    uint8_t i;
+
+    for (i = 0; i < HAL_UNIQUE_ID_BYTES; i++)
+        id[i] = hal_host_unique_id[i];
+}
+
+static inline uint8_t hal_eeprom_read(uint16_t addr)
+{
+    return hal_host_eeprom[addr % HAL_HOST_EEPROM_BYTES];
+}
+
+static inline void hal_eeprom_write(uint16_t addr, uint8_t data)
+{
+    hal_host_eeprom[addr % HAL_HOST_EEPROM_BYTES] = data;
+}
+
+/////////////////////////////////////////
+// harness
+
+/* Optional hooks for a plant model. advance is called before virtual
+ * time moves from one instant to the next, with the PWM compares and
+ * port outputs constant over the interval; tick is called just before
+ * the control interrupt is delivered, which is when the firmware
+ * samples its sensors. */
+extern void (*hal_host_advance)(uint64_t from, uint64_t to);
+extern void (*hal_host_tick)(void);
+
+void hal_host_run(uint32_t ticks, void (*idle)(void));
+void hal_host_reset_time(void);
+
+void hal_host_qdec_move(hal_qdec_e channel, int32_t counts);
+
+bool hal_host_twi_start(uint8_t address, bool read);
+bool hal_host_twi_send(uint8_t data);
+uint8_t hal_host_twi_recv(bool last);
+void hal_host_twi_stop(void);
+uint8_t hal_host_twi_load(void);
+void hal_host_twi_nack(void);
+void hal_host_twi_collision(void);
+
+int hal_host_twi_write(uint8_t address, const uint8_t* data, uint8_t len);
+int hal_host_twi_read(uint8_t address, uint8_t* data, uint8_t len);
+
+#endif /* HAL_HOST_H */
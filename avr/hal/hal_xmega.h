@@ -0,0 +1,354 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef HAL_XMEGA_H
+#define HAL_XMEGA_H
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#include "clksys/clksys_driver.h"
+#include "watchdog/wdt_driver.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// XMEGA backend
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* clock 1 (TCC1) is the control clock, clock 0 on port D (TCD0) is
+ * the motor PWM and the slave is on TWIC */
+#define HAL_TICK_vect TCC1_OVF_vect
+#define HAL_TWI_vect TWIC_TWIS_vect
+#define HAL_ADC_vect ADCA_CH0_vect
+
+/////////////////////////////////////////
+// GPIO
+
+typedef PORT_t* hal_port_t;
+
+#define HAL_PORTA (&PORTA)
+#define HAL_PORTB (&PORTB)
+#define HAL_PORTC (&PORTC)
+#define HAL_PORTD (&PORTD)
+#define HAL_PORTE (&PORTE)
+#define HAL_PORTR (&PORTR)
+
+static inline void hal_gpio_output(hal_port_t port, uint8_t mask)
+{
+    port->DIRSET = mask;
+}
+
+static inline void hal_gpio_pullup(hal_port_t port, uint8_t mask)
+{
+    /* the multi-pin config mask applies one PINnCTRL write to every
+     * pin in mask */
+    PORTCFG.MPCMASK = mask;
+    port->PIN0CTRL = (port->PIN0CTRL & ~PORT_OPC_gm) | PORT_OPC_PULLUP_gc;
+    PORTCFG.MPCMASK = 0x00;
+}
+
+static inline void hal_gpio_set(hal_port_t port, uint8_t mask)
+{
+    port->OUTSET = mask;
+}
+
+static inline void hal_gpio_clr(hal_port_t port, uint8_t mask)
+{
+    port->OUTCLR = mask;
+}
+
+static inline void hal_gpio_write(hal_port_t port, uint8_t mask, bool on)
+{
+    if (on)
+        port->OUTSET = mask;
+    else
+        port->OUTCLR = mask;
+}
+
+static inline uint8_t hal_gpio_read(hal_port_t port)
+{
+    return port->IN;
+}
+
+/////////////////////////////////////////
+// clock and interrupts
+
+static inline void hal_clock_init(void)
+{
+    /* start the 32MHz ring oscillator ticking */
+    CLKSYS_Enable(OSC_RC32MEN_bm);
+
+    /* set the clock prescaler to divide by 1 */
+    CLKSYS_Prescalers_Config(CLK_PSADIV_1_gc, CLK_PSBCDIV_1_1_gc);
+
+    /* wait until the 32MHz oscillator is stable */
+    do {nop();} while (CLKSYS_IsReady(OSC_RC32MRDY_bm) == 0);
+    /* and select it */
+    CLKSYS_Main_ClockSource_Select(CLK_SCLKSEL_RC32M_gc);
+}
+
+static inline void hal_irq_enable(uint8_t level)
+{
+    /* PMIC has one enable bit per level: LO is bit 0, MED 1, HI 2 */
+    PMIC.CTRL |= (1 << (level - 1));
+}
+
+/* Only the main loop changes the enable bits, so reading and writing
+ * them back isn't a race. An interrupt that comes in while its level
+ * is held stays pending and is taken on restore. */
+static inline uint8_t hal_irq_hold(uint8_t level)
+{
+    uint8_t held = PMIC.CTRL;
+
+    PMIC.CTRL = held & ~((1 << level) - 1);
+    return held;
+}
+
+static inline void hal_irq_restore(uint8_t held)
+{
+    PMIC.CTRL = held;
+}
+
+/////////////////////////////////////////
+// control clock
+
+static inline void hal_tick_init(uint16_t period, uint8_t level)
+{
+    TCC1.INTCTRLA = (TCC1.INTCTRLA & ~TC1_OVFINTLVL_gm) | (level << TC1_OVFINTLVL_gp);
+    /* ticks at 16MHz */
+    TCC1.CTRLA = (TCC1.CTRLA & ~TC1_CLKSEL_gm) | TC_CLKSEL_DIV2_gc;
+    TCC1.PER = period;
+}
+
+/* 16-bit timer reads go through the shared TEMP register, so they must
+ * not be interleaved with a read from a higher-priority interrupt */
+static inline uint16_t hal_tick_count(void)
+{
+    uint16_t t;
+    AVR_ENTER_CRITICAL_REGION();
+    t = TCC1.CNT;
+    AVR_LEAVE_CRITICAL_REGION();
+    return t;
+}
+
+static inline bool hal_tick_pending(void)
+{
+    return TCC1.INTFLAGS & TC1_OVFIF_bm;
+}
+
+/////////////////////////////////////////
+// motor PWM
+
+static inline void hal_pwm_init(uint16_t period)
+{
+    TCD0.CTRLB = 0x00;
+    TCD0.INTCTRLA &= ~TC0_OVFINTLVL_gm;
+    /* ticks at 16MHz */
+    TCD0.CTRLA = (TCD0.CTRLA & ~TC0_CLKSEL_gm) | TC_CLKSEL_DIV2_gc;
+    TCD0.PER = period;
+    /* single-slope PWM with both CCA and CCB enabled */
+    TCD0.CTRLB = (TCD0.CTRLB & ~TC0_WGMODE_gm) | TC_WGMODE_SS_gc | TC0_CCAEN_bm | TC0_CCBEN_bm;
+}
+
+static inline void hal_pwm_set(hal_pwm_e channel, uint16_t compare)
+{
+    if (channel == HAL_PWM_A)
+        TCD0.CCABUF = compare;
+    else
+        TCD0.CCBBUF = compare;
+}
+
+/* The hi-res extension would add two bits of compare resolution, but
+ * the D4 only has one, on port C, and it needs clkPER4 at four times
+ * clkPER, so the motor PWM does without. */
+static inline void hal_pwm_period(uint16_t period)
+{
+    TCD0.PERBUF = period;
+}
+
+/* the buffer valid flag is set by writing CCxBUF and cleared when the
+ * timer copies it into CCx at the update */
+static inline bool hal_pwm_pending(hal_pwm_e channel)
+{
+    return TCD0.CTRLGSET & (channel == HAL_PWM_A ? TC0_CCABV_bm : TC0_CCBBV_bm);
+}
+
+/////////////////////////////////////////
+// TWI slave
+
+static inline void hal_twi_slave_init(TWI_Slave_t* twi, uint8_t address,
+                                      void (*process)(void), uint8_t level)
+{
+    TWI_SlaveInitializeDriver(twi, &TWIC, process);
+    TWI_SlaveInitializeModule(twi, address, (TWI_SLAVE_INTLVL_t)(level << TWI_SLAVE_INTLVL_gp));
+}
+
+/////////////////////////////////////////
+// quadrature decoders
+
+/* Encoder A's phases are on PA2 (digital 1) and PA3, encoder B's on
+ * PB2 (digital 2) and PB3; the second phase shares a pin with analog 1
+ * and analog 6 respectively. Each pin pair feeds an event channel with
+ * quadrature decoding on, which counts a timer up or down on every
+ * edge: channel 0 drives TCC0 and channel 2 drives TCE0. The pins must
+ * sense both levels for the decoder to see them. */
+static inline void hal_qdec_init(hal_qdec_e channel)
+{
+    if (channel == HAL_QDEC_A)
+    {
+        PORTA.DIRCLR = PIN2_bm | PIN3_bm;
+        PORTCFG.MPCMASK = PIN2_bm | PIN3_bm;
+        PORTA.PIN2CTRL = PORT_ISC_LEVEL_gc | PORT_OPC_PULLUP_gc;
+        EVSYS.CH0MUX = EVSYS_CHMUX_PORTA_PIN2_gc;
+        EVSYS.CH0CTRL = EVSYS_QDEN_bm | EVSYS_DIGFILT_2SAMPLES_gc;
+        TCC0.CTRLD = TC_EVACT_QDEC_gc | TC_EVSEL_CH0_gc;
+        TCC0.PER = 0xffff;
+        TCC0.CTRLA = TC_CLKSEL_DIV1_gc;
+    }
+    else
+    {
+        PORTB.DIRCLR = PIN2_bm | PIN3_bm;
+        PORTCFG.MPCMASK = PIN2_bm | PIN3_bm;
+        PORTB.PIN2CTRL = PORT_ISC_LEVEL_gc | PORT_OPC_PULLUP_gc;
+        EVSYS.CH2MUX = EVSYS_CHMUX_PORTB_PIN2_gc;
+        EVSYS.CH2CTRL = EVSYS_QDEN_bm | EVSYS_DIGFILT_2SAMPLES_gc;
+        TCE0.CTRLD = TC_EVACT_QDEC_gc | TC_EVSEL_CH2_gc;
+        TCE0.PER = 0xffff;
+        TCE0.CTRLA = TC_CLKSEL_DIV1_gc;
+    }
+}
+
+/* only read from the control tick, so nothing else is using these
+ * timers' TEMP registers */
+static inline uint16_t hal_qdec_count(hal_qdec_e channel)
+{
+    return channel == HAL_QDEC_A ? TCC0.CNT : TCE0.CNT;
+}
+
+/////////////////////////////////////////
+// ADC
+
+/* Conversions on channel 0 are started either by TCD0 counting past
+ * phase, through its otherwise unused compare C and event channel 1,
+ * while the event action is armed, or by hal_adc_start(), and each raises the conversion complete
+ * interrupt. Compare C's output stays disabled; OC0C is the error
+ * pin. */
+static inline void hal_adc_init(uint16_t phase, uint8_t level)
+{
+    ADCA.CTRLB = ADC_RESOLUTION_12BIT_gc;
+    ADCA.REFCTRL = ADC_REFSEL_VCC_gc;
+    ADCA.PRESCALER = ADC_PRESCALER_DIV32_gc;
+    ADCA.CH0.CTRL = ADC_CH_INPUTMODE_SINGLEENDED_gc;
+    ADCA.CH0.INTCTRL = ADC_CH_INTMODE_COMPLETE_gc | (level << ADC_CH_INTLVL_gp);
+    TCD0.CCC = phase;
+    EVSYS.CH1MUX = EVSYS_CHMUX_TCD0_CCC_gc;
+    ADCA.EVCTRL = ADC_EVSEL_1234_gc | ADC_EVACT_NONE_gc;
+    ADCA.CTRLA = ADC_ENABLE_bm;
+}
+
+static inline void hal_adc_phase(uint16_t phase)
+{
+    TCD0.CCCBUF = phase;
+}
+
+static inline void hal_adc_arm(void)
+{
+    ADCA.EVCTRL = ADC_EVSEL_1234_gc | ADC_EVACT_CH0_gc;
+}
+
+static inline void hal_adc_disarm(void)
+{
+    ADCA.EVCTRL = ADC_EVSEL_1234_gc | ADC_EVACT_NONE_gc;
+}
+
+/* pins 0-7 are port A, 8-11 are port B 0-3 */
+static inline void hal_adc_select(uint8_t pin)
+{
+    ADCA.CH0.MUXCTRL = pin << ADC_CH_MUXPOS_gp;
+}
+
+static inline void hal_adc_start(void)
+{
+    ADCA.CH0.CTRL |= ADC_CH_START_bm;
+}
+
+/* only read from the conversion complete interrupt */
+static inline uint16_t hal_adc_result(void)
+{
+    return ADCA.CH0.RES;
+}
+
+/////////////////////////////////////////
+// watchdog
+
+static inline void hal_wdt_enable(void)
+{
+    WDT_EnableAndSetTimeout(WDT_PER_512CLK_gc);
+}
+
+static inline void hal_wdt_reset(void)
+{
+    WDT_Reset();
+}
+
+/////////////////////////////////////////
+// identity and EEPROM
+
+/* a byte of the production signature row */
+static inline uint8_t hal_prodsig(uint8_t offset)
+{
+    uint8_t data;
+
+    NVM.CMD = NVM_CMD_READ_CALIB_ROW_gc;
+    data = pgm_read_byte(offset);
+    NVM.CMD = NVM_CMD_NO_OPERATION_gc;
+    return data;
+}
+
+/* the lot number, wafer number and die coordinates Atmel writes to
+ * the signature row, which together no other chip has */
+static inline void hal_unique_id(uint8_t* id)
+{
+    id[0] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, LOTNUM0));
+    id[1] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, LOTNUM1));
+    id[2] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, LOTNUM2));
+    id[3] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, LOTNUM3));
+    id[4] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, LOTNUM4));
+    id[5] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, LOTNUM5));
+    id[6] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, WAFNUM));
+    id[7] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, COORDX0));
+    id[8] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, COORDX1));
+    id[9] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, COORDY0));
+    id[10] = hal_prodsig(offsetof(NVM_PROD_SIGNATURES_t, COORDY1));
+}
+
+static inline uint8_t hal_eeprom_read(uint16_t addr)
+{
+    return eeprom_read_byte((const uint8_t*)addr);
+}
+
+/* waits out any write already in progress, a few ms */
+static inline void hal_eeprom_write(uint16_t addr, uint8_t data)
+{
+    eeprom_update_byte((uint8_t*)addr, data);
+}
+
+#endif /* HAL_XMEGA_H */
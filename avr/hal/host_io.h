@@ -0,0 +1,116 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef HOST_IO_H
+#define HOST_IO_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Host stand-ins for the avr-libc headers
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Only what the firmware and the Atmel TWI slave driver touch
+ * directly. The TWI slave registers are modelled so the real driver
+ * state machine runs in the host build; hal_host.c plays the bus
+ * master against them. */
+
+typedef volatile uint8_t register8_t;
+typedef volatile uint16_t register16_t;
+
+#define PIN0_bm 0x01
+#define PIN1_bm 0x02
+#define PIN2_bm 0x04
+#define PIN3_bm 0x08
+#define PIN4_bm 0x10
+#define PIN5_bm 0x20
+#define PIN6_bm 0x40
+#define PIN7_bm 0x80
+
+/* Interrupts are delivered synchronously by the host harness between
+ * calls into the firmware, so they can never actually interleave; the
+ * global enable bit is still modelled so nothing is delivered before
+ * the firmware calls sei(). */
+extern uint8_t hal_host_sreg;
+#define SREG hal_host_sreg
+#define CPU_I_bm 0x80
+#define cli() ((void)(hal_host_sreg &= ~CPU_I_bm))
+#define sei() ((void)(hal_host_sreg |= CPU_I_bm))
+
+/* an interrupt handler is just a function the harness calls */
+#define ISR(vector) void vector(void)
+
+#define _delay_us(us) ((void)0)
+
+/////////////////////////////////////////
+// TWI
+
+typedef struct TWI_SLAVE_struct {
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t STATUS;
+    register8_t ADDR;
+    register8_t DATA;
+    register8_t ADDRMASK;
+} TWI_SLAVE_t;
+
+typedef struct TWI_struct {
+    register8_t CTRL;
+    TWI_SLAVE_t SLAVE;
+} TWI_t;
+
+typedef enum TWI_SLAVE_INTLVL_enum {
+    TWI_SLAVE_INTLVL_OFF_gc = (0x00<<6),
+    TWI_SLAVE_INTLVL_LO_gc = (0x01<<6),
+    TWI_SLAVE_INTLVL_MED_gc = (0x02<<6),
+    TWI_SLAVE_INTLVL_HI_gc = (0x03<<6),
+} TWI_SLAVE_INTLVL_t;
+
+#define TWI_SLAVE_INTLVL_gp 6
+
+/* CTRLA */
+#define TWI_SLAVE_DIEN_bm 0x20
+#define TWI_SLAVE_APIEN_bm 0x10
+#define TWI_SLAVE_ENABLE_bm 0x08
+#define TWI_SLAVE_PIEN_bm 0x04
+#define TWI_SLAVE_PMEN_bm 0x02
+#define TWI_SLAVE_SMEN_bm 0x01
+
+/* CTRLB */
+#define TWI_SLAVE_ACKACT_bm 0x04
+#define TWI_SLAVE_CMD_gm 0x03
+#define TWI_SLAVE_CMD_COMPTRANS_gc (0x02<<0)
+#define TWI_SLAVE_CMD_RESPONSE_gc (0x03<<0)
+
+/* ADDRMASK */
+#define TWI_SLAVE_ADDREN_bm 0x01
+
+/* STATUS */
+#define TWI_SLAVE_DIF_bm 0x80
+#define TWI_SLAVE_APIF_bm 0x40
+#define TWI_SLAVE_CLKHOLD_bm 0x20
+#define TWI_SLAVE_RXACK_bm 0x10
+#define TWI_SLAVE_COLL_bm 0x08
+#define TWI_SLAVE_BUSERR_bm 0x04
+#define TWI_SLAVE_DIR_bm 0x02
+#define TWI_SLAVE_AP_bm 0x01
+
+extern TWI_t TWIC;
+
+#endif /* HOST_IO_H */
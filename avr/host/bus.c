@@ -0,0 +1,452 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "avr_compiler.h"
+#include "hal/hal.h"
+#include "fixed.h"
+#include "pid.h"
+#include "motion.h"
+#include "path.h"
+#include "output.h"
+#include "current.h"
+#include "sched.h"
+#include "daughterboard.h"
+#include "i2c_commands.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Multi-board bus simulator
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Puts several boards on one simulated I2C bus and assigns their
+ * addresses with the enumerate and assign commands. The firmware's
+ * state is all globals, so each board is a child process running the
+ * unmodified firmware on the host HAL, with its own unique ID and
+ * EEPROM. This process is the bus and the master: it hands every bus
+ * event to each board that is on the bus at that point, and when
+ * several boards transmit at once it works out the wired-AND of their
+ * bits, MSB first, and tells the ones that lost arbitration. Between
+ * transactions every board runs for as long as the transaction took on
+ * the wire at 100kHz, main loop and all.
+ *
+ * The rows are checked and the exit status is nonzero if any fail. */
+
+#define BUS_HZ 100000
+#define BUS_TICK_HZ 10000       /* the firmware's control rate */
+#define BUS_BOARDS 6
+#define BUS_FIRST_ADDRESS 0x10
+
+typedef enum {
+    OP_START,           /* a = address, b = read; replies ack */
+    OP_SEND,            /* a = byte; replies ack */
+    OP_LOAD,            /* replies the byte the board sends */
+    OP_NACK,
+    OP_COLLISION,
+    OP_STOP,
+    OP_RUN,             /* a = ticks */
+    OP_EEPROM,          /* a = offset; replies the byte */
+} op_e;
+
+typedef struct {
+    pid_t pid;
+    int req;
+    int rep;
+    uint8_t id[HAL_UNIQUE_ID_BYTES];
+    uint8_t eeprom[2];  /* the address pair, carried across resets */
+    bool on;            /* still on the bus in this transaction */
+} board_t;
+
+/* one lot and wafer, so the IDs only differ in the die coordinates
+ * and arbitration has to get to the last few bytes; the last two
+ * differ in the final bit */
+static const uint8_t ids[BUS_BOARDS][HAL_UNIQUE_ID_BYTES] = {
+    { 0x4a, 0x31, 0x37, 0x30, 0x38, 0x31, 0x07, 0x12, 0x00, 0x1c, 0x00 },
+    { 0x4a, 0x31, 0x37, 0x30, 0x38, 0x31, 0x07, 0x03, 0x00, 0x2a, 0x00 },
+    { 0x4a, 0x31, 0x37, 0x30, 0x38, 0x31, 0x07, 0x12, 0x00, 0x09, 0x00 },
+    { 0x4a, 0x31, 0x37, 0x30, 0x38, 0x31, 0x07, 0x21, 0x00, 0x05, 0x00 },
+    { 0x4a, 0x31, 0x37, 0x30, 0x38, 0x31, 0x07, 0x03, 0x00, 0x2a, 0x01 },
+    { 0x4a, 0x31, 0x37, 0x30, 0x38, 0x31, 0x07, 0x0e, 0x00, 0x30, 0x00 },
+};
+
+static board_t boards[BUS_BOARDS];
+static uint32_t bus_bits;       /* time on the wire, in bit periods */
+
+/////////////////////////////////////////
+// boards
+
+/* the child: run the firmware and do what the bus says */
+static void board_main(board_t* b)
+{
+    uint8_t msg[3];
+    uint8_t rep;
+
+    memcpy(hal_host_unique_id, b->id, HAL_UNIQUE_ID_BYTES);
+    hal_host_eeprom[0] = b->eeprom[0];
+    hal_host_eeprom[1] = b->eeprom[1];
+    hal_host_reset_time();
+    init_board();
+
+    while (read(b->req, msg, 3) == 3)
+    {
+        rep = 0;
+        switch (msg[0])
+        {
+        case OP_START: rep = hal_host_twi_start(msg[1], msg[2]); break;
+        case OP_SEND: rep = hal_host_twi_send(msg[1]); break;
+        case OP_LOAD: rep = hal_host_twi_load(); break;
+        case OP_NACK: hal_host_twi_nack(); break;
+        case OP_COLLISION: hal_host_twi_collision(); break;
+        case OP_STOP: hal_host_twi_stop(); break;
+        case OP_RUN: hal_host_run(msg[1], do_mainloop); break;
+        case OP_EEPROM: rep = hal_host_eeprom[msg[1]]; break;
+        default: _exit(0);
+        }
+        if (write(b->rep, &rep, 1) != 1)
+            _exit(1);
+    }
+    _exit(0);
+}
+
+/* power a board up, with whatever is in its EEPROM */
+static void board_start(board_t* b)
+{
+    int req[2], rep[2];
+
+    if (pipe(req) || pipe(rep))
+    {
+        perror("pipe");
+        exit(2);
+    }
+    fflush(stdout);
+    b->pid = fork();
+    if (b->pid < 0)
+    {
+        perror("fork");
+        exit(2);
+    }
+    if (b->pid == 0)
+    {
+        /* or the other boards wouldn't see their bus go away */
+        for (int i = 0; i < BUS_BOARDS; i++)
+        {
+            if (&boards[i] != b && boards[i].pid > 0)
+            {
+                close(boards[i].req);
+                close(boards[i].rep);
+            }
+        }
+        close(req[1]);
+        close(rep[0]);
+        b->req = req[0];
+        b->rep = rep[1];
+        board_main(b);
+    }
+    close(req[0]);
+    close(rep[1]);
+    b->req = req[1];
+    b->rep = rep[0];
+}
+
+static uint8_t board_call(board_t* b, op_e op, uint8_t a, uint8_t arg)
+{
+    uint8_t msg[3] = { op, a, arg };
+    uint8_t rep;
+
+    if (write(b->req, msg, 3) != 3 || read(b->rep, &rep, 1) != 1)
+    {
+        fprintf(stderr, "board %d went away\n", (int)(b - boards));
+        exit(2);
+    }
+    return rep;
+}
+
+/* power a board down, keeping its EEPROM */
+static void board_stop(board_t* b)
+{
+    b->eeprom[0] = board_call(b, OP_EEPROM, 0, 0);
+    b->eeprom[1] = board_call(b, OP_EEPROM, 1, 0);
+    close(b->req);
+    close(b->rep);
+    waitpid(b->pid, 0, 0);
+}
+
+/////////////////////////////////////////
+// bus
+
+/* let every board run for as long as the bus has been busy */
+static void bus_idle(void)
+{
+    static uint32_t done;
+    uint32_t ticks = (uint32_t)((uint64_t)(bus_bits - done) * BUS_TICK_HZ
+                                / BUS_HZ) + 1;
+    int i;
+
+    done = bus_bits;
+    while (ticks)
+    {
+        uint8_t n = ticks > 255 ? 255 : ticks;
+        for (i = 0; i < BUS_BOARDS; i++)
+            board_call(&boards[i], OP_RUN, n, 0);
+        ticks -= n;
+    }
+}
+
+/* start and address; returns how many boards acknowledged, and only
+ * those stay on the bus */
+static int bus_start(uint8_t address, bool read)
+{
+    int acks = 0;
+    int i;
+
+    bus_bits += 1 + 9;
+    for (i = 0; i < BUS_BOARDS; i++)
+    {
+        boards[i].on = board_call(&boards[i], OP_START, address, read);
+        acks += boards[i].on;
+    }
+    return acks;
+}
+
+static void bus_stop(void)
+{
+    int i;
+
+    bus_bits += 1;
+    for (i = 0; i < BUS_BOARDS; i++)
+        board_call(&boards[i], OP_STOP, 0, 0);
+    bus_idle();
+}
+
+/* a write is acknowledged if any board on the bus acknowledges it;
+ * returns bytes sent, or -1 for no answer to the address */
+static int bus_write(uint8_t address, const uint8_t* data, uint8_t len)
+{
+    int sent = 0;
+    int i;
+
+    if (!bus_start(address, false))
+    {
+        bus_stop();
+        return -1;
+    }
+    while (sent < len)
+    {
+        bool ack = false;
+
+        bus_bits += 9;
+        for (i = 0; i < BUS_BOARDS; i++)
+        {
+            if (boards[i].on)
+                boards[i].on = board_call(&boards[i], OP_SEND, data[sent], 0);
+            ack |= boards[i].on;
+        }
+        sent++;
+        if (!ack)
+            break;
+    }
+    bus_stop();
+    return sent;
+}
+
+/* Every board on the bus sends each bit at once, and the bus is low if
+ * any of them sends a 0. A board that sends a 1 and sees a 0 has lost
+ * arbitration and sends nothing more. Returns the number of boards that
+ * answered the address, or 0 if none did. */
+static int bus_read(uint8_t address, uint8_t* data, uint8_t len)
+{
+    uint8_t sent[BUS_BOARDS];
+    int acks;
+    int i, j, bit;
+
+    acks = bus_start(address, true);
+    for (j = 0; acks && j < len; j++)
+    {
+        bus_bits += 9;
+        for (i = 0; i < BUS_BOARDS; i++)
+            if (boards[i].on)
+                sent[i] = board_call(&boards[i], OP_LOAD, 0, 0);
+
+        data[j] = 0;
+        for (bit = 7; bit >= 0; bit--)
+        {
+            uint8_t level = 1;
+            for (i = 0; i < BUS_BOARDS; i++)
+                if (boards[i].on)
+                    level &= sent[i] >> bit;
+            for (i = 0; i < BUS_BOARDS; i++)
+            {
+                if (boards[i].on && ((sent[i] >> bit) & 1) != level)
+                {
+                    board_call(&boards[i], OP_COLLISION, 0, 0);
+                    boards[i].on = false;
+                }
+            }
+            data[j] |= level << bit;
+        }
+    }
+    if (acks)
+        for (i = 0; i < BUS_BOARDS; i++)
+            if (boards[i].on)
+                board_call(&boards[i], OP_NACK, 0, 0);
+    bus_stop();
+    return acks;
+}
+
+/////////////////////////////////////////
+// checks
+
+static bool check(bool ok, const char* what)
+{
+    printf("%-48s %s\n", what, ok ? " ok" : " FAIL");
+    return ok;
+}
+
+static int board_with_id(const uint8_t* id)
+{
+    int i;
+
+    for (i = 0; i < BUS_BOARDS; i++)
+        if (!memcmp(boards[i].id, id, HAL_UNIQUE_ID_BYTES))
+            return i;
+    return -1;
+}
+
+/* Enumerate the bus and assign addresses: BUS_FIRST_ADDRESS up in the
+ * order the boards are found, or what each has already if keep. Each
+ * board must turn up exactly once, lowest ID first. */
+static bool enumerate(bool keep, uint8_t* assigned)
+{
+    uint8_t cmd = I2C_CMD_ENUMERATE;
+    uint8_t reply[I2C_ENUMERATE_REPLY];
+    uint8_t assign[I2C_CMD_ASSIGN_BYTES];
+    uint32_t start = bus_bits;
+    bool found[BUS_BOARDS] = { false };
+    int last = -1;
+    int rounds = 0;
+    bool ok = true;
+    char what[64];
+
+    bus_write(0x00, &cmd, 1);
+    while (bus_read(I2C_ENUMERATE_ADDRESS, reply, sizeof(reply)) > 0)
+    {
+        int b = board_with_id(reply);
+
+        if (b < 0 || found[b] || rounds >= BUS_BOARDS)
+        {
+            printf("  round %d: got a board twice or a garbled ID\n", rounds);
+            ok = false;
+            break;
+        }
+        if (last >= 0 && memcmp(boards[last].id, reply, HAL_UNIQUE_ID_BYTES) > 0)
+            ok = false;
+        found[b] = true;
+        last = b;
+
+        assign[0] = I2C_CMD_ASSIGN;
+        memcpy(&assign[1], reply, HAL_UNIQUE_ID_BYTES);
+        assigned[b] = keep ? reply[HAL_UNIQUE_ID_BYTES]
+                           : BUS_FIRST_ADDRESS + rounds;
+        assign[I2C_CMD_ASSIGN_BYTES - 1] = assigned[b];
+        bus_write(0x00, assign, sizeof(assign));
+        rounds++;
+    }
+
+    snprintf(what, sizeof(what), "enumerated %d boards in %.1fms%s",
+             rounds, (bus_bits - start) * 1000.0 / BUS_HZ,
+             keep ? ", addresses kept" : "");
+    return check(ok && rounds == BUS_BOARDS, what);
+}
+
+/* each board answers its own address and no other board does */
+static bool addressed(const uint8_t* assigned)
+{
+    int i;
+
+    for (i = 0; i < BUS_BOARDS; i++)
+    {
+        bool alone = bus_start(assigned[i], false) == 1 && boards[i].on;
+        bus_stop();
+        if (!alone)
+            return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    uint8_t assigned[BUS_BOARDS];
+    uint8_t again[BUS_BOARDS];
+    bool ok = true;
+    int n;
+    int i;
+
+    for (i = 0; i < BUS_BOARDS; i++)
+    {
+        memcpy(boards[i].id, ids[i], HAL_UNIQUE_ID_BYTES);
+        boards[i].eeprom[0] = 0xff;
+        boards[i].eeprom[1] = 0xff;
+        board_start(&boards[i]);
+    }
+    bus_idle();
+
+    n = bus_start(0x55, false);
+    bus_stop();
+    ok &= check(n == BUS_BOARDS, "every board starts at 0x55");
+
+    ok &= enumerate(false, assigned);
+    ok &= check(addressed(assigned), "each board alone at its address");
+    n = bus_start(0x55, false);
+    bus_stop();
+    ok &= check(n == 0, "nothing left at 0x55");
+    n = bus_start(I2C_ENUMERATE_ADDRESS, true);
+    bus_stop();
+    ok &= check(n == 0, "nothing left at the enumeration address");
+
+    /* long enough for housekeeping to put the addresses in EEPROM */
+    bus_bits += BUS_HZ / 20;
+    bus_idle();
+    for (i = 0; i < BUS_BOARDS; i++)
+    {
+        board_stop(&boards[i]);
+        board_start(&boards[i]);
+    }
+    bus_idle();
+    ok &= check(addressed(assigned), "each board at its address after a reset");
+
+    ok &= enumerate(true, again);
+    ok &= check(!memcmp(assigned, again, sizeof(again)) && addressed(again),
+                "reenumerating reports the same addresses");
+
+    for (i = 0; i < BUS_BOARDS; i++)
+        board_stop(&boards[i]);
+    return ok ? 0 : 1;
+}
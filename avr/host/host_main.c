@@ -0,0 +1,286 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr_compiler.h"
+#include "hal/hal.h"
+#include "fixed.h"
+#include "pid.h"
+#include "motion.h"
+#include "path.h"
+#include "output.h"
+#include "current.h"
+#include "sched.h"
+#include "daughterboard.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Host harness
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Runs the firmware against virtual time, driven by a script on stdin
+ * (or in the file named on the command line), one command per line:
+ *
+ *   run N          advance N control ticks
+ *   addr HH        set the slave address used by w and r (default 55)
+ *   w HH HH ...    I2C write of the given hex bytes, then one pass
+ *                  of the main loop, which is what decodes it
+ *   q HH HH ...    I2C write of the given hex bytes, left queued for
+ *                  the next main loop pass, e.g. the one after the
+ *                  next tick of a run
+ *   r N            I2C read of N bytes, printed in hex
+ *   x N HH HH ...  I2C write of the hex bytes, then a repeated start
+ *                  and a read of N bytes, then one pass of the main
+ *                  loop
+ *   qdec A|B N     turn encoder A or B by N counts
+ *   adc PIN N      set what ADC pin PIN (0-11) reads
+ *   state [A|B]    print both motor channels, or one
+ *   expect WORD .. check that the words appear together, in order,
+ *                  in what the command before printed, and say
+ *                  ok or FAIL
+ *
+ * Anything after a # is a comment. The exit status is 1 if any
+ * expect failed. */
+
+#define LINE_MAX 256
+#define OUTPUT_MAX 1024
+
+static uint8_t address = 0x55;
+
+/* what the last command printed, for expect */
+static char output[OUTPUT_MAX];
+static size_t output_len;
+static bool failed;
+
+static void say(const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    if (output_len < sizeof(output))
+    {
+        va_start(ap, fmt);
+        output_len += vsnprintf(output + output_len, sizeof(output) - output_len,
+                                fmt, ap);
+        va_end(ap);
+    }
+}
+
+/* squeeze every run of whitespace in s down to one space */
+static void squeeze(char* s)
+{
+    char* out = s;
+    bool space = false;
+
+    for (; *s; s++)
+    {
+        if (strchr(" \t\n", *s))
+        {
+            if (!space)
+                *out++ = ' ';
+            space = true;
+        }
+        else
+        {
+            *out++ = *s;
+            space = false;
+        }
+    }
+    *out = 0;
+}
+
+/* are the words of want next to each other, in order, in what the
+ * last command printed */
+static void do_expect(char* want)
+{
+    char text[OUTPUT_MAX + 2];
+    const char* p;
+    size_t n;
+    bool ok = false;
+
+    squeeze(want);
+    if (want[0] == ' ')
+        want++;
+    n = strlen(want);
+    if (n && want[n - 1] == ' ')
+        want[--n] = 0;
+    snprintf(text, sizeof(text), " %s ", output);
+    squeeze(text);
+    for (p = strstr(text, want); n && p && !ok; p = strstr(p + 1, want))
+        ok = p[-1] == ' ' && p[n] == ' ';
+    printf("  %-46s  %s\n", want, ok ? "ok" : "FAIL");
+    failed |= !ok;
+}
+
+static void print_channel(const char* name, motor_channel_t* mot)
+{
+    say("%s: closed=%d sensor=%d command=%" PRId32 " drive=%" PRId32
+           " target=%" PRId32
+           " error=%" PRId32 " measured=%" PRId32 "\n",
+           name, mot->closed, mot->sensorchan, mot->command, mot->output.drive,
+           mot->cont.target, (int32_t)mot->cont.e_cur,
+           sensor_functions[mot->sensorchan & 0x0f]
+           ? sensor_functions[mot->sensorchan & 0x0f]() : 0);
+}
+
+static void do_write(char* args, bool decode)
+{
+    uint8_t buf[LINE_MAX];
+    int len = 0;
+    char* tok;
+
+    for (tok = strtok(args, " \t"); tok && len < (int)sizeof(buf); tok = strtok(0, " \t"))
+        buf[len++] = strtoul(tok, 0, 16);
+
+    say("%s: %d\n", decode ? "w" : "q", hal_host_twi_write(address, buf, len));
+    if (decode)
+        do_mainloop();
+}
+
+static void do_read(char* args)
+{
+    uint8_t buf[LINE_MAX];
+    int len = atoi(args);
+    int got;
+
+    if (len <= 0 || len > (int)sizeof(buf))
+        return;
+    got = hal_host_twi_read(address, buf, len);
+    if (got < 0)
+    {
+        say("r: nack\n");
+        return;
+    }
+    say("r:");
+    for (int i = 0; i < got; i++)
+        say(" %02x", buf[i]);
+    say("\n");
+}
+
+static void do_exchange(char* args)
+{
+    char* end;
+    int len = strtol(args, &end, 0);
+    char* tok;
+
+    if (len <= 0 || !hal_host_twi_start(address, false))
+    {
+        say("x: nack\n");
+        return;
+    }
+    for (tok = strtok(end, " \t"); tok; tok = strtok(0, " \t"))
+        if (!hal_host_twi_send(strtoul(tok, 0, 16)))
+            break;
+    if (!hal_host_twi_start(address, true))
+        say("x: nack");
+    else
+    {
+        say("x:");
+        for (int i = 0; i < len; i++)
+            say(" %02x", hal_host_twi_recv(i == len - 1));
+    }
+    say("\n");
+    hal_host_twi_stop();
+    do_mainloop();
+}
+
+int main(int argc, char** argv)
+{
+    char line[LINE_MAX];
+    FILE* in = stdin;
+
+    if (argc > 1 && !(in = fopen(argv[1], "r")))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    init_board();
+
+    while (fgets(line, sizeof(line), in))
+    {
+        char* cmd;
+        char* args;
+
+        if ((cmd = strchr(line, '#')))
+            *cmd = 0;
+        cmd = strtok(line, " \t\n");
+        if (!cmd)
+            continue;
+        args = strtok(0, "\n");
+        if (!args)
+            args = "";
+
+        if (!strcmp(cmd, "expect"))
+        {
+            do_expect(args);
+            continue;
+        }
+        output_len = 0;
+        output[0] = 0;
+
+        if (!strcmp(cmd, "run"))
+            hal_host_run(strtoul(args, 0, 0), do_mainloop);
+        else if (!strcmp(cmd, "addr"))
+            address = strtoul(args, 0, 16);
+        else if (!strcmp(cmd, "w"))
+            do_write(args, true);
+        else if (!strcmp(cmd, "q"))
+            do_write(args, false);
+        else if (!strcmp(cmd, "r"))
+            do_read(args);
+        else if (!strcmp(cmd, "x"))
+            do_exchange(args);
+        else if (!strcmp(cmd, "qdec"))
+            hal_host_qdec_move(args[0] == 'B' ? HAL_QDEC_B : HAL_QDEC_A,
+                               strtol(args + 1, 0, 0));
+        else if (!strcmp(cmd, "adc"))
+        {
+            unsigned pin;
+            unsigned value;
+            if (sscanf(args, "%u %u", &pin, &value) == 2 && pin < 12)
+                hal_host_adc[pin] = value;
+        }
+        else if (!strcmp(cmd, "state"))
+        {
+            say("t=%" PRIu64 " ticks=%u\n", hal_host_time, sched_ticks);
+            if (args[0] != 'B')
+                print_channel("A", &motA);
+            if (args[0] != 'A')
+                print_channel("B", &motB);
+        }
+        else
+            fprintf(stderr, "unknown command %s\n", cmd);
+    }
+
+    return failed;
+}
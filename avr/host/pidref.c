@@ -0,0 +1,348 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fixed.h"
+#include "pid.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// PID reference check
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Runs pid.c tick by tick against a double precision controller of
+ * the same form, fed the same targets and measurements, and checks
+ * two things for each case:
+ *
+ *   coefs  pid_prepare()'s a0..a2 are within a unit in the last place
+ *          of the formulas worked out in double from the gains the
+ *          controller holds
+ *   exact  with those coefficients, every pid_update() output is the
+ *          same as the double controller's; every sum the update
+ *          does is exact in double, so this checks the 32x16 bit
+ *          multiplies, the error and output clamps and the target
+ *          step handling bit for bit
+ *
+ * The ideal column is the largest difference from a double controller
+ * with the gains as given, before they were rounded to fixed point.
+ * It isn't checked; it's what the gain format costs.
+ *
+ * The format check switches a running controller between Q16.16 and
+ * Q.24 and ticks it both before and after pid_prepare() picks up the
+ * change, as the tick can between a set format command and the main
+ * loop; the output mustn't move by more than the rounding. The exit
+ * status is nonzero if any check fails.
+ *
+ * Controller cost is measured on the host, which only says that it
+ * has no slow paths; the cycle count on the board is the get profile
+ * command's controllers probe in a PROFILE build. */
+
+#define REF_RATE 10000
+#define REF_TICKS 20000
+#define REF_BENCH_UPDATES 1000000
+
+typedef enum {
+    SIG_STEP = 0,               /* a step, followed by a lagging sensor */
+    SIG_SINE = 1,               /* target still, sensor swinging */
+    SIG_JUMPS = 2,              /* big target jumps and sensor noise */
+} signal_e;
+
+typedef struct {
+    const char* name;
+    uint8_t q;
+    double P;
+    double I;
+    double D;
+    int32_t out_max;
+    signal_e signal;
+    int32_t size;               /* of the step, swing or jumps */
+} refcase_t;
+
+static const refcase_t cases[] = {
+    { "step",      FIX_Q16, 30,    100,   1,      0xffff, SIG_STEP,  2000 },
+    { "sine",      FIX_Q16, 30,    100,   1,      0xffff, SIG_SINE,  3000 },
+    { "small",     FIX_Q24, 0.5,   0.02,  0.0001, 0xffff, SIG_SINE,  100 },
+    { "fine I",    FIX_Q24, 2,     3,     0,      0xffff, SIG_STEP,  500 },
+    { "saturate",  FIX_Q16, 500,   2000,  0.5,    0xffff, SIG_STEP,  2000 },
+    { "negative",  FIX_Q16, -3,    -40,   -0.25,  0xffff, SIG_SINE,  5000 },
+    { "big error", FIX_Q16, 0.75,  10,    0,      0xffff, SIG_JUMPS, 100000 },
+    { "big Q24",   FIX_Q24, 20,    120,   0.001,  0xffff, SIG_JUMPS, 40000 },
+    { "cascade",   FIX_Q16, 4,     50,    0.01,   PID_ERROR_MAX, SIG_JUMPS, 8000 },
+};
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+/* double precision controller, same velocity form as pid.c */
+typedef struct {
+    double a0;
+    double a1;
+    double a2;
+    double kp;
+    double u;
+    double e_cur;
+    double e_last;
+    double e_prev;
+    double lim;
+    int32_t target_last;
+} ref_t;
+
+static uint32_t noise_state;
+
+/////////////////////////////////////////
+// inputs
+
+/* a small repeatable noise, -range..range */
+static int32_t noise(int32_t range)
+{
+    noise_state = noise_state * 1664525 + 1013904223;
+    return (int32_t)(noise_state >> 8) % (range + 1)
+        * ((noise_state & 0x80) ? -1 : 1);
+}
+
+static void inputs(const refcase_t* rc, uint32_t k, int32_t* target,
+                   int32_t* measured)
+{
+    double t = (double)k / REF_RATE;
+
+    switch (rc->signal)
+    {
+    case SIG_STEP:
+        *target = k < 100 ? 0 : rc->size;
+        *measured = k < 100 ? 0
+            : (int32_t)(rc->size * (1 - exp(-(k - 100) / 500.0))) + noise(3);
+        break;
+    case SIG_SINE:
+        *target = 0;
+        *measured = (int32_t)(rc->size * sin(2 * M_PI * 7 * t)) + noise(5);
+        break;
+    case SIG_JUMPS:
+        /* a new target every 1000 ticks, anywhere in -size..size */
+        if (k % 1000 == 0)
+            *target = noise(rc->size);
+        *measured = *target / 2 + noise(rc->size / 50);
+        break;
+    }
+}
+
+/////////////////////////////////////////
+// reference
+
+static double clamp16(double e)
+{
+    return e > PID_ERROR_MAX ? PID_ERROR_MAX
+        : e < -PID_ERROR_MAX ? -PID_ERROR_MAX : e;
+}
+
+static void ref_init(ref_t* r, double a0, double a1, double a2, double kp,
+                     double lim)
+{
+    r->a0 = a0;
+    r->a1 = a1;
+    r->a2 = a2;
+    r->kp = kp;
+    r->u = 0;
+    r->e_cur = 0;
+    r->e_last = 0;
+    r->e_prev = 0;
+    r->lim = lim;
+    r->target_last = 0;
+}
+
+static int32_t ref_update(ref_t* r, int32_t target, int32_t measured)
+{
+    if (target != r->target_last)
+    {
+        double step = (double)target - r->target_last;
+        r->e_cur = clamp16(r->e_cur + step);
+        r->e_last = clamp16(r->e_last + step);
+        r->u += r->kp * clamp16(step);
+        r->target_last = target;
+    }
+
+    r->e_prev = r->e_last;
+    r->e_last = r->e_cur;
+    r->e_cur = clamp16((double)target - measured);
+
+    r->u += r->a0 * r->e_cur + r->a1 * r->e_last + r->a2 * r->e_prev;
+    if (r->u > r->lim) r->u = r->lim;
+    if (r->u < -r->lim) r->u = -r->lim;
+    return (int32_t)floor(r->u);
+}
+
+/////////////////////////////////////////
+// checks
+
+static fix_t to_fix(double x, uint8_t q)
+{
+    return fix_sat((int64_t)llround(ldexp(x, q)));
+}
+
+/* are pid_prepare()'s coefficients within one unit of the formulas */
+static bool check_coefs(const controller_t* c)
+{
+    const pid_coefs_t* k = &c->coefs[c->coef_idx];
+    double P = c->P;
+    double I = c->I;
+    double D = c->D;
+
+    return fabs(k->a0 - (P + I / c->rate + D * c->rate)) <= 1
+        && fabs(k->a1 - (-P - 2 * D * c->rate)) <= 1
+        && fabs(k->a2 - D * c->rate) <= 1
+        && k->kp == c->P;
+}
+
+static bool run_case(const refcase_t* rc)
+{
+    controller_t c;
+    const pid_coefs_t* k;
+    ref_t same, ideal;
+    double s;
+    int32_t target = 0, measured = 0;
+    uint32_t diffs = 0;
+    double worst = 0;
+    bool coefs;
+
+    pid_init(&c, rc->q, REF_RATE, -rc->out_max, rc->out_max);
+    c.P = to_fix(rc->P, rc->q);
+    c.I = to_fix(rc->I, rc->q);
+    c.D = to_fix(rc->D, rc->q);
+    c.dirty = true;
+    pid_prepare(&c);
+    coefs = check_coefs(&c);
+
+    k = &c.coefs[c.coef_idx];
+    s = ldexp(1, -rc->q);
+    ref_init(&same, k->a0 * s, k->a1 * s, k->a2 * s, k->kp * s, rc->out_max);
+    ref_init(&ideal, rc->P + rc->I / REF_RATE + rc->D * REF_RATE,
+             -rc->P - 2 * rc->D * REF_RATE, rc->D * REF_RATE, rc->P,
+             rc->out_max);
+
+    noise_state = 1;
+    for (uint32_t i = 0; i < REF_TICKS; i++)
+    {
+        int32_t out, want, best;
+
+        inputs(rc, i, &target, &measured);
+        c.target = target;
+        out = pid_update(&c, measured);
+        want = ref_update(&same, target, measured);
+        best = ref_update(&ideal, target, measured);
+        if (out != want)
+            diffs++;
+        if (fabs((double)out - best) > worst)
+            worst = fabs((double)out - best);
+    }
+
+    printf("%-10s Q%-2u %7" PRIu32 "  %-5s %-5s %9.1f  %s\n", rc->name, rc->q,
+           (uint32_t)REF_TICKS, coefs ? "ok" : "FAIL", diffs ? "FAIL" : "ok",
+           worst, coefs && !diffs ? "ok" : "FAIL");
+    return coefs && !diffs;
+}
+
+/* a format change, ticked through both before and after the new
+ * coefficients are swapped in */
+static bool check_format(void)
+{
+    static const uint8_t formats[] = { FIX_Q24, FIX_Q16, FIX_Q24 };
+    controller_t c;
+    int32_t last = 0;
+    int32_t worst = 0;
+
+    pid_init(&c, FIX_Q16, REF_RATE, -0xffff, 0xffff);
+    c.P = to_fix(2, FIX_Q16);
+    c.I = to_fix(50, FIX_Q16);
+    c.dirty = true;
+    pid_prepare(&c);
+    c.target = 1000;
+
+    for (uint32_t i = 0; i < 4000; i++)
+    {
+        int32_t out;
+
+        if (i % 1000 == 999)
+            pid_set_format(&c, formats[i / 1000]);
+        if (i % 1000 == 2)
+            pid_prepare(&c);
+
+        /* a steady error, so the output only ramps by I */
+        out = pid_update(&c, 900);
+        if (i > 0 && abs(out - last) > worst)
+            worst = abs(out - last);
+        last = out;
+    }
+
+    printf("format     %9u  %-5s %15" PRId32 "  %s\n", 4000u,
+           worst <= 1 ? "ok" : "FAIL", worst, worst <= 1 ? "ok" : "FAIL");
+    return worst <= 1;
+}
+
+/////////////////////////////////////////
+// cost
+
+static void bench(void)
+{
+    static int32_t meas[1024];
+    volatile int32_t sink = 0;
+    struct timespec start, end;
+    controller_t c;
+    uint32_t i;
+
+    for (i = 0; i < 1024; i++)
+        meas[i] = (int32_t)(i * 7919 % 4001) - 2000;
+
+    pid_init(&c, FIX_Q16, REF_RATE, -0xffff, 0xffff);
+    c.P = to_fix(30, FIX_Q16);
+    c.I = to_fix(100, FIX_Q16);
+    c.D = to_fix(1, FIX_Q16);
+    c.dirty = true;
+    pid_prepare(&c);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < REF_BENCH_UPDATES; i++)
+        sink += pid_update(&c, meas[i & 1023]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    (void)sink;
+    printf("pid_update on this host: %.1fns\n",
+           ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+           / REF_BENCH_UPDATES);
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    printf("case       q     ticks  coefs exact     ideal\n");
+    for (unsigned i = 0; i < CASE_COUNT; i++)
+        ok &= run_case(&cases[i]);
+    ok &= check_format();
+    bench();
+
+    return ok ? 0 : 1;
+}
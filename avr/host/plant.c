@@ -0,0 +1,92 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+
+#include "plant.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Plant
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* a small 12V gearmotor-sized motor with a 512 line encoder: 0.5ms
+ * electrical and 0.1s mechanical time constants, about 600rad/s no
+ * load */
+void plant_init(plant_t* p, uint8_t order)
+{
+    p->order = order;
+    p->R = 2.0;
+    p->L = 1e-3;
+    p->Ke = 0.02;
+    p->Kt = 0.02;
+    p->J = 2e-5;
+    p->B = 1e-5;
+    p->Tc = 2e-3;
+    p->V = 12.0;
+    p->counts_per_rad = 2048 / (2 * M_PI);
+    plant_reset(p);
+}
+
+void plant_reset(plant_t* p)
+{
+    p->i = 0;
+    p->w = 0;
+    p->theta = 0;
+    p->load = 0;
+}
+
+/* Advance by dt with v across the winding. Semi-implicit Euler; dt
+ * should be well under the electrical time constant. Coulomb friction
+ * holds a stopped rotor until the drive torque beats it, and can slow
+ * a moving rotor to a stop but never push it backwards. */
+void plant_step(plant_t* p, double v, double dt)
+{
+    double torque;
+    double w;
+
+    if (p->order >= 2)
+        p->i += dt * (v - p->R * p->i - p->Ke * p->w) / p->L;
+    else
+        p->i = (v - p->Ke * p->w) / p->R;
+
+    torque = p->Kt * p->i - p->load;
+
+    if (p->w == 0 && fabs(torque) <= p->Tc)
+        return;
+
+    w = p->w + dt * (torque - p->B * p->w
+                     - copysign(p->Tc, p->w != 0 ? p->w : torque)) / p->J;
+    /* friction stopped it this step */
+    if (p->w != 0 && (w > 0) != (p->w > 0) && fabs(torque) <= p->Tc)
+        w = 0;
+    p->w = w;
+    p->theta += dt * p->w;
+}
+
+/* what the encoder counter reads */
+int32_t plant_encoder(const plant_t* p)
+{
+    return (int32_t)floor(p->theta * p->counts_per_rad);
+}
@@ -0,0 +1,61 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// DC motor plant
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* A brushed DC motor behind an H-bridge, with a quadrature encoder on
+ * the shaft. The second order model has both the winding (R, L, back
+ * EMF) and the rotor (J, viscous and Coulomb friction); the first
+ * order model drops the inductance, so the current follows the
+ * voltage instantly. Everything is SI: ohms, henries, volts, N*m/A,
+ * V*s/rad, kg*m^2, N*m*s/rad, N*m. */
+
+typedef struct {
+    /* parameters */
+    uint8_t order;              /* 1 or 2 */
+    double R;
+    double L;
+    double Ke;
+    double Kt;
+    double J;
+    double B;
+    double Tc;                  /* Coulomb friction */
+    double V;                   /* supply */
+    double counts_per_rad;      /* encoder resolution after x4 decoding */
+
+    /* state */
+    double i;
+    double w;
+    double theta;
+    double load;                /* external torque opposing motion */
+} plant_t;
+
+void plant_init(plant_t* p, uint8_t order);
+void plant_reset(plant_t* p);
+void plant_step(plant_t* p, double v, double dt);
+int32_t plant_encoder(const plant_t* p);
+
+#endif /* PLANT_H */
@@ -0,0 +1,512 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avr_compiler.h"
+#include "hal/hal.h"
+#include "fixed.h"
+#include "pid.h"
+#include "motion.h"
+#include "path.h"
+#include "output.h"
+#include "current.h"
+#include "sched.h"
+#include "daughterboard.h"
+#include "i2c_commands.h"
+#include "plant.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Closed loop simulator
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Runs the firmware's motor A channel against a simulated DC motor
+ * and reports how well it controls it. The firmware runs unmodified
+ * on the host HAL; the plant integrates between interrupts from the
+ * bridge pins and the TCD0 compare, and turns encoder A through the
+ * quadrature decoder model, which the firmware reads as sensor 0. Each scenario is run with the firmware's fixed
+ * point PID and with a double precision PID of the same form and
+ * gains as a reference, on both plant models.
+ *
+ * The fixed point rows are checked against the scenario's limits and
+ * the exit status is nonzero if any fail, so this doubles as a
+ * regression check for the controller. Options:
+ *
+ *   -r HZ      control rate (default 10000)
+ *   -q BITS    gain format, 16 or 24 (default 16)
+ *   -o ORDER   only run the first or second order plant
+ *   -m MODE    PWM mode, as sent with I2C_CMD_SET_PWM_MODE (default 0)
+ *   -P/-I/-D   gains, as sent over I2C
+ *   -t NAME    print a CSV trace of one scenario instead
+ *
+ * Controller cost is measured on the host, which only says which
+ * variant is cheaper; build with PROFILE and use GET_PROFILE for
+ * cycles on the board. */
+
+#define SIM_CLOCK_HZ 16000000.0     /* TCC1 and TCD0 count at this */
+#define SIM_SUBSTEP 16              /* plant step, clock counts */
+#define SIM_BENCH_UPDATES 1000000
+
+typedef enum {
+    CTRL_FIXED = 0,
+    CTRL_FLOAT = 1,
+    CTRL_COUNT = 2,
+} ctrl_e;
+
+static const char* ctrl_names[CTRL_COUNT] = { "fixed", "float" };
+
+/* Targets and errors are in encoder counts. Before t0 the target is
+ * zero; at t0 it steps (or ramps at ramp counts/s) to target and the
+ * load torque is applied. With a move velocity the step is sent as an
+ * onboard move instead, and errors are against the trajectory. A limit
+ * below zero isn't checked.
+ *
+ * The steady state limit is per PWM mode. In the legacy mode the 4ms
+ * pulses break the plant's Coulomb friction every period; with the
+ * smooth current of the faster modes the shaft sticks once the load
+ * comes on, until the integral has wound up past the friction, and
+ * then creeps back in. At the default gains the disturbance scenario
+ * is still some 11 counts out at the end at 8kHz and 17 at 20kHz, and
+ * the float reference is the same, so its limits there are set above
+ * that rather than at the legacy mode's 10. */
+typedef struct {
+    const char* name;
+    double duration;            /* s */
+    double t0;                  /* s */
+    int32_t target;
+    double ramp;
+    double load;                /* N*m */
+    uint32_t move_v;            /* move limits, counts/s^n; 0 for none */
+    uint32_t move_a;
+    uint32_t move_j;
+    double band;                /* settled when the error is within this */
+    double settle_max;          /* ms after t0 */
+    double overshoot_max;       /* percent of the step */
+    double sserr_max[I2C_PWM_MODES]; /* mean |error| over the last 10% */
+    double peak_max;            /* largest |error| after t0 */
+} scenario_t;
+
+typedef struct {
+    double settle;
+    double overshoot;
+    double sserr;
+    double peak;
+    double ss_sum;
+    uint32_t ss_n;
+} result_t;
+
+/* double precision reference, same velocity form as pid.c */
+typedef struct {
+    double a0;
+    double a1;
+    double a2;
+    double u;
+    double e1;
+    double e2;
+    double lim;
+    int32_t target_last;
+} fpid_t;
+
+static const scenario_t scenarios[] = {
+    { "step",    1.0,  0.05, 2000,  0,     0,     0,     0,      0,
+      40,  900, 30, { 40,  40,  40 },  -1 },
+    { "ramp",    1.0,  0.05, 2000,  5000,  0,     0,     0,      0,
+      40,  -1,  20, { 120, 120, 120 }, 400 },
+    { "disturb", 1.0,  0.05, 0,     0,     0.01,  0,     0,      0,
+      40,  800, -1, { 10,  15,  22 },  200 },
+    { "move",    1.0,  0.05, 2000,  0,     0,     10000, 100000, 2000000,
+      40,  -1,  20, { 80,  80,  80 },  600 },
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static uint16_t rate = 10000;
+static uint8_t q = FIX_Q16;
+static uint8_t pwm_mode = I2C_PWM_MODE_LEGACY;
+static double gain_P = 30.0;
+static double gain_I = 100.0;
+static double gain_D = 1.0;
+
+static plant_t plant;
+static ctrl_e ctrl;
+static const scenario_t* scen;
+static fpid_t fpid;
+static result_t result;
+static uint64_t t_start;
+static int32_t sim_counts;
+static bool tracing;
+static bool moving;
+
+/////////////////////////////////////////
+// reference controller
+
+static void fpid_init(fpid_t* f, double lim)
+{
+    double dt = 1.0 / rate;
+
+    f->a0 = gain_P + gain_I * dt + gain_D / dt;
+    f->a1 = -gain_P - 2 * gain_D / dt;
+    f->a2 = gain_D / dt;
+    f->u = 0;
+    f->e1 = 0;
+    f->e2 = 0;
+    f->lim = lim;
+    f->target_last = 0;
+}
+
+static int32_t fpid_update(fpid_t* f, int32_t target, int32_t measurement)
+{
+    double e = (double)target - measurement;
+
+    if (target != f->target_last)
+    {
+        f->e1 += target - f->target_last;
+        f->e2 += target - f->target_last;
+        f->u += gain_P * (target - f->target_last);
+        f->target_last = target;
+    }
+    if (e > PID_ERROR_MAX) e = PID_ERROR_MAX;
+    if (e < -PID_ERROR_MAX) e = -PID_ERROR_MAX;
+    f->u += f->a0 * e + f->a1 * f->e1 + f->a2 * f->e2;
+    if (f->u > f->lim) f->u = f->lim;
+    if (f->u < -f->lim) f->u = -f->lim;
+    f->e2 = f->e1;
+    f->e1 = e;
+    return (int32_t)floor(f->u);
+}
+
+static fix_t to_fix(double x)
+{
+    return fix_sat((int64_t)llround(ldexp(x, q)));
+}
+
+static void set_gains(controller_t* c)
+{
+    pid_set_format(c, q);
+    pid_set_rate(c, rate);
+    c->P = to_fix(gain_P);
+    c->I = to_fix(gain_I);
+    c->D = to_fix(gain_D);
+    c->dirty = true;
+    pid_prepare(c);
+    pid_reset(c);
+}
+
+/////////////////////////////////////////
+// plant hookup
+
+static double sim_time(void)
+{
+    return (hal_host_time - t_start) / SIM_CLOCK_HZ;
+}
+
+/* Motor A's bridge: B_1 high drives forward, A_1 high drives in
+ * reverse, and it's only switched on for the last duty counts of each
+ * PWM period, which is what the PERIOD - duty compare is for. */
+static double bridge_voltage(uint64_t t)
+{
+    uint32_t len = (uint32_t)hal_host_pwm_period + 1;
+    uint8_t out = HAL_PORTD->out;
+    bool fwd = out & PIN_MOT_CONTROL_B_1;
+    bool rev = out & PIN_MOT_CONTROL_A_1;
+
+    if (fwd == rev)
+        return 0;
+    if ((t - hal_host_pwm_start) % len <= hal_host_pwm_compare[HAL_PWM_A])
+        return 0;
+    return fwd ? plant.V : -plant.V;
+}
+
+static void sim_advance(uint64_t from, uint64_t to)
+{
+    while (from < to)
+    {
+        uint64_t next = from + SIM_SUBSTEP;
+        if (next > to)
+            next = to;
+        plant_step(&plant, bridge_voltage(from), (next - from) / SIM_CLOCK_HZ);
+        hal_host_qdec_move(HAL_QDEC_A, plant_encoder(&plant) - sim_counts);
+        sim_counts = plant_encoder(&plant);
+        from = next;
+    }
+}
+
+static int32_t scenario_target(const scenario_t* s, double t)
+{
+    double ramped;
+
+    if (t < s->t0)
+        return 0;
+    if (s->move_v)
+    {
+        /* the firmware only runs the generator with the loop closed,
+         * so the reference controller's is run from here */
+        if (!moving)
+        {
+            motA.motion.vmax = s->move_v;
+            motA.motion.amax = s->move_a;
+            motA.motion.jmax = s->move_j;
+            motion_request(&motA.motion, s->target);
+            moving = true;
+        }
+        if (ctrl == CTRL_FLOAT)
+        {
+            motion_update(&motA.motion);
+            return motA.motion.setpoint;
+        }
+        return motA.cont.target;
+    }
+    if (s->ramp == 0)
+        return s->target;
+    ramped = s->ramp * (t - s->t0);
+    return ramped < s->target ? (int32_t)ramped : s->target;
+}
+
+/* sample the plant and record the metrics, just before the control
+ * interrupt; the reference controller runs here too */
+static void sim_tick(void)
+{
+    double t = sim_time();
+    int32_t target = scenario_target(scen, t);
+    int32_t pos = plant_encoder(&plant);
+    double e = (double)target - pos;
+
+    plant.load = t >= scen->t0 ? scen->load : 0;
+
+    /* the reference runs the channel open loop, where the target is
+     * the duty cycle */
+    if (ctrl == CTRL_FLOAT)
+        motA.cont.target = fpid_update(&fpid, target, pos);
+    else if (!scen->move_v)
+        motA.cont.target = target;
+
+    if (tracing)
+        printf("%.5f,%" PRId32 ",%" PRId32 ",%" PRId32 ",%.4f\n", t, target,
+               pos, motA.output.drive, plant.i);
+
+    if (t < scen->t0)
+        return;
+    if (fabs(e) > scen->band)
+        result.settle = (t - scen->t0) * 1000;
+    if (fabs(e) > result.peak)
+        result.peak = fabs(e);
+    if (scen->target != 0)
+    {
+        double over = 100.0 * (pos - scen->target) / scen->target;
+        if (over > result.overshoot)
+            result.overshoot = over;
+    }
+    if (t >= scen->duration * 0.9)
+    {
+        result.ss_sum += fabs(e);
+        result.ss_n++;
+    }
+}
+
+/////////////////////////////////////////
+// running
+
+static void run(const scenario_t* s, ctrl_e c)
+{
+    hal_host_reset_time();
+    init_board();
+    motor_set_pwm_mode(pwm_mode);
+    hal_host_tick_period = (uint16_t)(SIM_CLOCK_HZ / rate) - 1;
+
+    plant_reset(&plant);
+    sim_counts = 0;
+    motA.sensorchan = SENSOR_ENCODER_A;
+    motA.closed = (c == CTRL_FIXED);
+    set_gains(&motA.cont);
+    fpid_init(&fpid, 0xffff);
+
+    scen = s;
+    ctrl = c;
+    moving = false;
+    memset(&result, 0, sizeof(result));
+    result.overshoot = s->target != 0 ? 0 : NAN;
+    t_start = hal_host_time;
+
+    hal_host_advance = sim_advance;
+    hal_host_tick = sim_tick;
+    hal_host_run((uint32_t)(s->duration * rate), do_mainloop);
+    hal_host_advance = 0;
+    hal_host_tick = 0;
+
+    result.sserr = result.ss_n ? result.ss_sum / result.ss_n : NAN;
+}
+
+/* a result that doesn't apply, such as the overshoot of a scenario
+ * with no step, is NAN; it prints as n/a so runs compare as text */
+static void print_result(const char* fmt, int width, double value)
+{
+    if (isnan(value))
+        printf(" %*s", width, "n/a");
+    else
+        printf(fmt, value);
+}
+
+static bool over_limit(double value, double limit)
+{
+    return limit >= 0 && !(value <= limit);
+}
+
+static bool report(const scenario_t* s, ctrl_e c)
+{
+    bool fail = false;
+
+    if (c == CTRL_FIXED)
+        fail = over_limit(result.settle, s->settle_max)
+            || over_limit(result.overshoot, s->overshoot_max)
+            || over_limit(result.sserr, s->sserr_max[pwm_mode])
+            || over_limit(result.peak, s->peak_max);
+
+    printf("%-8s %5u  %-5s %6u", s->name, plant.order, ctrl_names[c], rate);
+    print_result(" %9.1f", 9, result.settle);
+    print_result(" %9.1f", 9, result.overshoot);
+    print_result(" %8.2f", 8, result.sserr);
+    print_result(" %8.0f", 8, result.peak);
+    printf("  %s\n", c != CTRL_FIXED ? "" : fail ? "FAIL" : "ok");
+    return !fail;
+}
+
+/////////////////////////////////////////
+// controller cost
+
+static double ns_since(const struct timespec* start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void bench(void)
+{
+    static int32_t meas[1024];
+    volatile int32_t sink = 0;
+    struct timespec start;
+    controller_t c;
+    fpid_t f;
+    double fixed_ns, float_ns;
+    uint32_t i;
+
+    for (i = 0; i < 1024; i++)
+        meas[i] = (int32_t)(i * 7919 % 4001) - 2000;
+
+    pid_init(&c, q, rate, -0xffff, 0xffff);
+    set_gains(&c);
+    fpid_init(&f, 0xffff);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < SIM_BENCH_UPDATES; i++)
+        sink += pid_update(&c, meas[i & 1023]);
+    fixed_ns = ns_since(&start) / SIM_BENCH_UPDATES;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < SIM_BENCH_UPDATES; i++)
+        sink += fpid_update(&f, 0, meas[i & 1023]);
+    float_ns = ns_since(&start) / SIM_BENCH_UPDATES;
+
+    (void)sink;
+    printf("controller update on this host: fixed %.1fns, float %.1fns\n",
+           fixed_ns, float_ns);
+}
+
+int main(int argc, char** argv)
+{
+    const char* trace = 0;
+    int order = 0;
+    bool ok = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:q:o:m:P:I:D:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': rate = atoi(optarg); break;
+        case 'q': q = atoi(optarg); break;
+        case 'o': order = atoi(optarg); break;
+        case 'm': pwm_mode = atoi(optarg); break;
+        case 'P': gain_P = atof(optarg); break;
+        case 'I': gain_I = atof(optarg); break;
+        case 'D': gain_D = atof(optarg); break;
+        case 't': trace = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-r hz] [-q bits] [-o order] "
+                    "[-m mode] [-P p] [-I i] [-D d] [-t scenario]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rate < 250 || rate > 20000 || (q != FIX_Q16 && q != FIX_Q24)
+        || order < 0 || order > 2 || pwm_mode >= I2C_PWM_MODES)
+    {
+        fprintf(stderr, "rate must be 250-20000Hz, q 16 or 24, order 1 or 2, "
+                "PWM mode 0-%u\n", I2C_PWM_MODES - 1);
+        return 2;
+    }
+
+    if (trace)
+    {
+        for (unsigned s = 0; s < SCENARIO_COUNT; s++)
+        {
+            if (strcmp(scenarios[s].name, trace))
+                continue;
+            plant_init(&plant, order ? order : 2);
+            tracing = true;
+            printf("t,target,position,duty,current\n");
+            run(&scenarios[s], CTRL_FIXED);
+            return 0;
+        }
+        fprintf(stderr, "no scenario %s\n", trace);
+        return 2;
+    }
+
+    printf("P=%g I=%g D=%g, Q%u gains, PWM mode %u\n",
+           gain_P, gain_I, gain_D, q, pwm_mode);
+    printf("scenario order  ctrl    rate settle_ms overshoot   sserr     peak\n");
+    for (int o = 1; o <= 2; o++)
+    {
+        if (order && o != order)
+            continue;
+        plant_init(&plant, o);
+        for (unsigned s = 0; s < SCENARIO_COUNT; s++)
+        {
+            for (int c = 0; c < CTRL_COUNT; c++)
+            {
+                run(&scenarios[s], c);
+                ok &= report(&scenarios[s], c);
+            }
+        }
+    }
+    bench();
+
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,15 @@
 //I2C Interface:
 
+/*Every write transaction is one command: the command byte and its
+arguments, up to 68 bytes in all. Up to four commands are queued as
+they come in and carried out by the board's main loop shortly after, each one
+between two control ticks, so a command never takes effect halfway.
+A command with the wrong number of bytes is ignored. Replies are read
+in a separate read transaction (or after a repeated start); until the
+commands before it have been carried out, a read is NACKed at its
+address and should be retried. So is a write while the queue is full.
+A write longer than 68 bytes is NACKed where it overflows and dropped.*/
+
 //--------------------------------------------------
 //stop
 //0x00
@@ -32,17 +42,18 @@ time to cleanly shut down sensors and other peripherals.*/
 //0x03 BB
 #define I2C_CMD_GO 0x03
 #define I2C_CMD_GO_BYTES 2
-/*Instructs the motor controller to run. The two bytes (16-bit int)
-specify a timeout - if the controller hasn't received an update within
-this many ticks of clock0 (default 10kHz), it will assume that the
-master has died and will pause (this will behave the same as if a 0x01
-is sent). For example, sending 0x03 0x10 0x00 will run the motor for
-.4 seconds without further orders.
+/*Instructs the motor controller to run. The two bytes (16-bit int,
+lowest-order byte first) specify a timeout - if the controller hasn't
+received a command, or a latch, within this many control ticks
+(10kHz), it will assume that the master has died and will stop both
+motors, opening both loops and setting the duty cycles to zero. For
+example, sending 0x03 0xa0 0x0f will run the motor for .4 seconds
+without further orders. A timeout of zero turns this off, which is
+how the board starts.
 
-Note that the motor controller will not do _anything at all_ with the
-motors unless this command is sent, that it will _immediately_ stop
-the motors if the timer runs out, and the maximum timeout is just over
-six seconds. This is intentional.*/
+Note that it will _immediately_ stop the motors if the timer runs
+out, and the maximum timeout is just over six seconds. This is
+intentional.*/
 
 //--------------------------------------------------
 //set motor sensor channel
@@ -59,7 +70,8 @@ The input byte is broken down into two sections. The highest-order
 on or off the PID controller; when off, the channel simply uses the
 target as a duty cycle. If the second bit is 1, then the PID
 controller is started and the lowest-order bits specify one of the 16
-sensor functions.
+sensor functions. A channel in closed loop on a sensor number with no
+function behind it isn't driven at all.
 
 As some examples:
 
@@ -75,12 +87,112 @@ the chosen sensor reports position, then the controller will interpret
 the target as a position and know that it's controlling a second-order
 controller.*/
 
+//--------------------------------------------------
+//set analog oversampling
+//0x11 B
+#define I2C_CMD_SET_ANALOG_OVERSAMPLE 0x11
+#define I2C_CMD_SET_ANALOG_OVERSAMPLE_BYTES 1
+/*Set how many conversions of an analog input are averaged into each
+sample. The high nibble selects the input, 0-5 for analog 1-6; the
+low nibble is the log2 of the number of conversions, 0-4 for 1 to 16.
+Larger values are treated as 4. The default is 0, a single conversion.
+All six inputs are swept every millisecond, or every PWM period if
+that's longer, starting at the same point in the period every time;
+only the sweep's first conversion is at that point, and the rest
+follow it as fast as the ADC goes.*/
+
+//--------------------------------------------------
+//set PWM mode
+//0x12 B
+#define I2C_CMD_SET_PWM_MODE 0x12
+#define I2C_CMD_SET_PWM_MODE_BYTES 1
+#define I2C_PWM_MODE_LEGACY 0
+#define I2C_PWM_MODE_8KHZ 1
+#define I2C_PWM_MODE_20KHZ 2
+#define I2C_PWM_MODES 3
+/*Set the motor PWM frequency for both channels, trading resolution
+for frequency:
+
+0 legacy, 244Hz with 65536 steps; the default
+1 8kHz with 2000 steps
+2 20kHz with 800 steps, above hearing
+
+Other values are ignored. Duty cycles are a fraction of 65536 in every
+mode and are scaled to the period, so nothing else changes. In the
+faster modes the compare dithers between neighbouring steps, so on
+average the bridge still gets all 16 bits. The change takes effect at
+the end of the PWM period that's running, with the duty cycles
+rescaled in the same update. A duty cycle worked out by the control
+loop is in effect from the start of the next PWM period. The control
+loop runs at 10kHz, so at 20kHz each duty cycle it works out is held
+for two PWM periods; a channel under current control is updated with
+every current sample instead, which is every PWM period when only one
+channel's current is sensed.*/
+
+//--------------------------------------------------
+//set output stage
+//0x13 B WW B
+#define I2C_CMD_SET_OUTPUT 0x13
+#define I2C_CMD_SET_OUTPUT_BYTES 4
+/*Set how a channel's command, the signed duty cycle from its
+controller, reaches the bridge. The first byte's high bit selects the
+channel, and its low bit makes the bridge brake (short the motor) when
+the duty cycle is zero instead of coasting. Then comes the most the
+duty cycle may change in one control tick, as a 16-bit int in 65536ths
+of full (0 for no limit), and the number of control ticks to wait at
+zero before reversing. A reversal always stops at zero for at least a
+tick and until the bridge has finished the PWM period it was in. The
+default is no slew limit, no wait and coasting.*/
+
+//--------------------------------------------------
+//set cascade
+//0x14 B B B B B WW
+#define I2C_CMD_SET_CASCADE 0x14
+#define I2C_CMD_SET_CASCADE_BYTES 7
+#define I2C_CASCADE_CURRENT 0x01
+#define I2C_CASCADE_VELOCITY 0x02
+#define I2C_STAGE_OUTER 0
+#define I2C_STAGE_VELOCITY 1
+#define I2C_STAGE_CURRENT 2
+/*Set up a channel's control cascade. The first byte's high bit selects
+the channel; its bit 0 adds a current loop and its bit 1 a velocity
+stage. With neither the controller drives the bridge, as it always has.
+
+With a velocity stage, the controller's output is the target of a
+second controller that reads the sensor in the third byte (numbered as
+in set motor sensor channel), and that one's output goes on down.
+
+With a current loop, the last stage's output is a target current in
+ADC counts, limited to +-the last argument (at most 4095). The loop
+reads the current sense output on analog input 1-6 (second byte, 0-5)
+once every PWM period, or every other period when both channels have
+one since the two take turns, in the middle of the part of the period
+the bridge is on for, and sets the duty cycle straight away. The sample is
+taken to flow the way the bridge is driving. Its gains are P in duty
+cycle counts per ADC count and I in the same per second, Q16.16;
+they're rescaled whenever the PWM mode changes. It has no D. P must be
+from 0 to under 256 and I from 0 to under the current loop's update
+rate (samples per second); a gain outside that is ignored. An I that
+was in range saturates if a slower PWM mode lowers the rate below it.
+
+The fourth and fifth bytes are how many control ticks apart the
+controller and the velocity stage run (0 is taken as 1); each holds
+its output in between. Every stage starts again from zero.
+
+Set controller P, I, D and format (0x21-0x24) pick the stage with bits
+5-4 of their first byte: 0 the controller, 1 the velocity stage, 2 the
+current loop. The current loop has no D or format. The default is no
+cascade.*/
+
 //--------------------------------------------------
 //set controller target
 //0x20 B BBBB
 #define I2C_CMD_SET_CONTROLLER_TARGET 0x20
 #define I2C_CMD_SET_CONTROLLER_TARGET_BYTES 5
-/*Set the controller's target value. It's a 32-bit float.
+/*Set the controller's target value. It's a 32-bit float. The first
+byte selects the motor channel (highest-order bit, as in the sensor
+channel command). The target is in the units of the channel's sensor
+and is rounded toward zero to a whole number of them.
 
 To transfer the value, push the bytes of the target, starting with the
 lowest-order (least significant) byte and going to the highest-order
@@ -91,7 +203,11 @@ lowest-order (least significant) byte and going to the highest-order
 //0x21 B BBBB
 #define I2C_CMD_SET_CONTROLLER_P 0x21
 #define I2C_CMD_SET_CONTROLLER_P_BYTES 5
-/*Set the controller's proportional constant. It's a 32-bit float.
+/*Set the controller's proportional constant. It's a 32-bit float. The
+first byte selects the motor channel. The gain is in duty cycle counts
+per sensor unit and is converted to the channel's fixed-point format
+on arrival; the loop period is folded in by the board, so the value
+doesn't depend on the control rate.
 
 To transfer the value, push the bytes of the target, starting with the
 lowest-order (least significant) byte and going to the highest-order
@@ -102,7 +218,11 @@ lowest-order (least significant) byte and going to the highest-order
 //0x22 B BBBB
 #define I2C_CMD_SET_CONTROLLER_I 0x22
 #define I2C_CMD_SET_CONTROLLER_I_BYTES 5
-/*Set the controller's integral constant. It's a 32-bit float.
+/*Set the controller's integral constant. It's a 32-bit float. The
+first byte selects the motor channel. The gain is per second of
+accumulated error and is converted to the channel's fixed-point format
+on arrival; the loop period is folded in by the board, so the value
+doesn't depend on the control rate.
 
 To transfer the value, push the bytes of the target, starting with the
 lowest-order (least significant) byte and going to the highest-order
@@ -113,12 +233,302 @@ lowest-order (least significant) byte and going to the highest-order
 //0x23 B BBBB
 #define I2C_CMD_SET_CONTROLLER_D 0x23
 #define I2C_CMD_SET_CONTROLLER_D_BYTES 5
-/*Set the controller's derivative constant. It's a 32-bit float.
+/*Set the controller's derivative constant. It's a 32-bit float. The
+first byte selects the motor channel. The gain is in seconds (it
+multiplies the rate of change of the error) and is converted to the
+channel's fixed-point format on arrival; the loop period is folded in
+by the board, so the value doesn't depend on the control rate.
 
 To transfer the value, push the bytes of the target, starting with the
 lowest-order (least significant) byte and going to the highest-order
 (most significant, ending with the sign) byte.*/
 
+//--------------------------------------------------
+//set controller format
+//0x24 B
+#define I2C_CMD_SET_CONTROLLER_FORMAT 0x24
+#define I2C_CMD_SET_CONTROLLER_FORMAT_BYTES 1
+/*Select the fixed-point format the channel's controller keeps its
+gains in. The highest-order bit selects the motor channel, as in the
+sensor channel command. The second highest bit picks the format: 0 is
+Q16.16 (gains up to +-32768 with a resolution of about 1.5e-5), 1 is
+Q8.24 (gains up to +-128 with a resolution of about 6e-8). Gains that
+are already set are converted, so this can be sent before or after
+them. The default is Q16.16. Channels with a small integral gain
+should use Q8.24, since the gain is divided by the loop rate before
+it's used.*/
+
+//--------------------------------------------------
+//set compact scale
+//0x25 B B B BBBB
+#define I2C_CMD_SET_COMPACT_SCALE 0x25
+#define I2C_CMD_SET_COMPACT_SCALE_BYTES 7
+/*Set how a channel's compact commands are scaled. The first byte
+selects the motor channel (highest-order bit). The next is the target
+shift: a compact target of t means a target of base + t * 2^shift
+sensor units. The next is the gain shift: a compact gain of g means
+g * 2^shift in the channel's raw fixed-point format, so in Q16.16 a
+shift of 8 gives gains up to +-128 in steps of 1/256. Shifts over 31
+are taken as 31. Last is the base, a 32-bit int, lowest-order byte
+first. Everything starts at zero, so a compact target is just a
+target and a compact gain a raw one.*/
+
+//--------------------------------------------------
+//set compact target
+//0x26 B BB
+#define I2C_CMD_SET_COMPACT_TARGET 0x26
+#define I2C_CMD_SET_COMPACT_TARGET_BYTES 3
+/*Set the controller's target from a 16-bit int, lowest-order byte
+first, scaled as set by the set compact scale command. The first byte
+selects the motor channel. It has the same effect as the set
+controller target command, with no floating point on the board: the
+target is a shift and an add.*/
+
+//--------------------------------------------------
+//set compact gains
+//0x27 B BB BB BB
+#define I2C_CMD_SET_COMPACT_GAINS 0x27
+#define I2C_CMD_SET_COMPACT_GAINS_BYTES 7
+/*Set all three of a channel's controller gains at once. The first
+byte selects the motor channel; then come P, I and D, each a 16-bit
+int, lowest-order byte first, scaled as set by the set compact scale
+command. The gains take effect together.*/
+
+//--------------------------------------------------
+//set compact targets
+//0x28 BB BB
+#define I2C_CMD_SET_COMPACT_TARGETS 0x28
+#define I2C_CMD_SET_COMPACT_TARGETS_BYTES 4
+/*Set both channels' targets in one command: channel A's then channel
+B's, each a 16-bit int, lowest-order byte first, scaled as for the set
+compact target command. Both take effect on the same control tick.
+With the command byte this is five bytes, against twelve for two set
+controller target commands.*/
+
+//--------------------------------------------------
+//exchange
+//0x29 [BB BB]
+#define I2C_CMD_EXCHANGE 0x29
+#define I2C_CMD_EXCHANGE_BYTES 4
+#define I2C_CMD_EXCHANGE_REPLY 24
+#define I2C_EXCHANGE_CHANNEL 11
+#define I2C_EXCHANGE_REVERSE 0x01
+#define I2C_EXCHANGE_CLOSED 0x02
+#define I2C_EXCHANGE_MOVING 0x04
+#define I2C_EXCHANGE_PATH 0x08
+/*Write both channels' targets and read both channels' state in one
+transaction: send this, then a repeated start and a read of up to 24
+bytes. The targets are the same as for the set compact targets
+command and may be left off to only read. The reply is ready at once,
+without waiting for the board to carry out the command; it's built
+from the control loop's state every millisecond. A read after this
+command, with or without a repeated start, gets the reply until
+another command is sent.
+
+The reply starts with the control tick count it's from as a 16-bit
+int, which wraps. Then comes eleven bytes for channel A and eleven for
+channel B: the channel's sensor value as a 32-bit int, the velocity
+of the channel's quadrature input in counts per second as a 32-bit
+int, the duty cycle the output stage is giving the bridge as a 16-bit
+int, and a status byte. Its bit 0 is set when that is reversed, bit 1 in closed loop, bit 2 while
+a move is running and bit 3 while a path is. All are lowest-order byte
+first.*/
+
+//--------------------------------------------------
+//stage targets
+//0x2a BB BB
+#define I2C_CMD_STAGE_TARGETS 0x2a
+#define I2C_CMD_STAGE_TARGETS_BYTES 4
+/*Stage new targets for both channels, to be applied by the next latch:
+channel A's then channel B's, each a 16-bit int, lowest-order byte
+first, scaled as for the set compact target command. Any move or path
+on either channel stops when this is carried out, and the targets stay
+where they are until the latch.*/
+
+//--------------------------------------------------
+//latch
+//0x2b
+#define I2C_CMD_LATCH 0x2b
+/*Apply the staged targets. Send this to the general call address
+(0x00) and every board applies its staged targets on its first control
+tick after the command byte arrives, so they all move together, within
+a control tick of each other. A board that hasn't yet carried out
+every command sent before the latch, such as a stage sent just ahead
+of it, carries those out first and applies the latch on the tick
+after, so a latch always applies the stage before it. A board whose
+command buffers are all full still takes a latch sent to the general
+call address, though it NACKs any other write until it has room, so
+the master can count on every board that ACKed the latch having it. It
+can be sent to one board's own address too. A channel with nothing staged is left alone. A latch also
+counts as a command for the go command's timeout, so one broadcast
+keeps every board running.*/
+
+//--------------------------------------------------
+//enumerate
+//0x2c
+#define I2C_CMD_ENUMERATE 0x2c
+#define I2C_ENUMERATE_ADDRESS 0x0e
+#define I2C_ENUMERATE_REPLY 12
+/*Start assigning addresses. Send this to the general call address
+(0x00). Every board then also answers reads at the enumeration address
+0x0e, all at once, with twelve bytes: its 11-byte unique ID (the lot
+number, wafer number and die coordinates from the chip's signature
+row) and then its current address. The boards keep their addresses
+and carry on as usual meanwhile. Because each bit goes out on the
+wired-AND bus together, the board with the lowest ID wins arbitration
+and the rest drop off the bus, so the read gets one whole, consistent
+reply. Assign that board an address and read again; each read finds
+the next board, and once every board has been assigned the read is
+NACKed. N boards take N+1 reads and N assigns, about 2.5ms per board at
+100kHz. A board that loses arbitration partway sends nothing more in
+that read, so a read can't come back with a mix of two replies.*/
+
+//--------------------------------------------------
+//assign address
+//0x2d BBBBBBBBBBB B
+#define I2C_CMD_ASSIGN 0x2d
+#define I2C_CMD_ASSIGN_BYTES 13
+/*Set the address of the board whose unique ID matches the first 11
+bytes to the last byte, and stop it answering the enumeration address
+until the next enumerate. Send it to the general call address (0x00);
+the board it's for takes the new address as soon as the last byte
+arrives, so the next read of the enumeration address already finds
+the next board. To keep the address a board has, assign it that one.
+Addresses 0x08 to 0x77, other than 0x0e, are accepted; anything else
+is ignored. The address is kept in EEPROM and used from then on,
+including after a reset; a board with nothing in EEPROM uses 0x55.
+Addresses aren't checked for clashes: giving two boards the same one
+is the master's mistake.*/
+
+//--------------------------------------------------
+//set move velocity limit
+//0x30 B BBBB
+#define I2C_CMD_SET_MOVE_VELOCITY 0x30
+#define I2C_CMD_SET_MOVE_VELOCITY_BYTES 5
+/*Set the largest velocity the channel's moves may use, in sensor
+units per second. It's a 32-bit float, sent like the controller
+target; the first byte selects the motor channel (highest-order bit).
+Negative values are taken as zero. A channel won't move until both
+this and the acceleration limit are set.*/
+
+//--------------------------------------------------
+//set move acceleration limit
+//0x31 B BBBB
+#define I2C_CMD_SET_MOVE_ACCELERATION 0x31
+#define I2C_CMD_SET_MOVE_ACCELERATION_BYTES 5
+/*Set the largest acceleration the channel's moves may use, in sensor
+units per second per second. Sent like the velocity limit.*/
+
+//--------------------------------------------------
+//set move jerk limit
+//0x32 B BBBB
+#define I2C_CMD_SET_MOVE_JERK 0x32
+#define I2C_CMD_SET_MOVE_JERK_BYTES 5
+/*Set the largest jerk the channel's moves may use, in sensor units
+per second cubed. Zero (the default) gives trapezoidal moves, where
+the acceleration switches instantly; anything else gives S-curves,
+which take an extra acceleration-limit/jerk-limit seconds. Sent like
+the velocity limit.*/
+
+//--------------------------------------------------
+//move
+//0x33 B BBBB
+#define I2C_CMD_MOVE 0x33
+#define I2C_CMD_MOVE_BYTES 5
+/*Move the channel to a position, in sensor units, within the
+channel's limits. Sent like the controller target. The board
+generates the profile itself and feeds the controller a new target
+every control tick; the channel has to be in closed loop on a
+position sensor. A move sent while another is running starts when that
+one ends; a move sent while one is already waiting replaces the
+waiting one. Setting the controller target or the sensor channel, or
+pushing waypoints, cancels moves and leaves the target where it was. Moves are limited to
+2^31-1 units.*/
+
+//--------------------------------------------------
+//push waypoints
+//0x34 B BBBBBB ...
+#define I2C_CMD_PUSH_WAYPOINTS 0x34
+#define I2C_CMD_PUSH_WAYPOINTS_BYTES 7
+#define I2C_CMD_PUSH_WAYPOINTS_EACH 6
+/*Queue up to 11 waypoints for a channel's path. The first byte selects
+the motor channel (highest-order bit) and, in the second highest bit,
+whether the segments to these waypoints are cubic (1) or straight lines
+(0). Each waypoint is six bytes: a 16-bit unsigned int, the number of
+control ticks after the previous waypoint that this one should be
+reached, then the position in sensor units as a 32-bit int, both
+lowest-order byte first. Bytes left over after the last whole
+waypoint are ignored.
+
+The board interpolates between waypoints in the control tick and feeds
+the controller a new target every tick; the channel has to be in
+closed loop on a position sensor. The path starts from the
+controller's target. A cubic segment is a Hermite curve with the slope
+at each waypoint set from the waypoints either side, so the board has
+to have the waypoint after next to hand when a segment starts; if it
+doesn't, the segment ends with the channel at rest. Up to 16 waypoints
+are buffered per channel. A dt of zero is taken as one tick and dts
+over 2048 ticks as 2048; a waypoint more than 2^24 units from the one
+before is moved closer.
+
+If the board runs out of waypoints, the target stays on the last one
+reached and time stops; when more come in, the path carries on from
+there. A waypoint that doesn't fit in the buffer is dropped and the
+overflow bit set in the path status. Pushing waypoints cancels any
+move, and a move, controller target or sensor channel command clears
+the path, leaving the target where it was.*/
+
+//--------------------------------------------------
+//set telemetry
+//0x35 B BB
+#define I2C_CMD_SET_TELEMETRY 0x35
+#define I2C_CMD_SET_TELEMETRY_BYTES 3
+/*Record control data for reading back in bulk with the get telemetry
+command. The first byte selects the fields in each sample: bits 0-3
+are channel A's target, measurement, error and duty cycle, and bits
+4-7 the same for channel B. The next two are a 16-bit unsigned int,
+lowest-order byte first: a sample is taken every that many control
+ticks, after the controllers have run, or never if it's zero. Any
+samples not yet read are thrown away and the sequence starts again
+from zero.
+
+Each sample is a 16-bit sequence number, then each selected field, in
+bit order, as a 16-bit int; all are lowest-order byte first. The
+target and measurement are the low 16 bits of the value, the error
+saturates at -32768 and 32767, and the duty cycle is halved and
+negative when the direction is reversed. The sequence number counts
+every sample taken, so a sample the board had no room for, or one a
+read was cut short in the middle of, shows up as a gap. The board
+holds 95 words of samples; a sample of one channel's four fields is
+five words.*/
+
+//--------------------------------------------------
+//set capture
+//0x36 B BB B BB B
+#define I2C_CMD_SET_CAPTURE 0x36
+#define I2C_CMD_SET_CAPTURE_BYTES 7
+/*Arm a capture of control data into the telemetry buffer, like a
+scope. The first three bytes are the same as for the set telemetry
+command, except that a decimation of zero means every control tick.
+The next byte is the trigger: its low nibble is 0 to trigger at once,
+1 when a field rises from below to at or above a level, 2 when it
+falls from above to at or below it, 3 when either channel's mode (the
+byte from the set motor sensor channel command) changes, and 4 when
+any part of the control loop overruns its time slot. The high nibble
+is the field a rising or falling trigger is on, numbered by its bit in
+the field mask; it needn't be one of the recorded fields. Then comes
+the level, a 16-bit int, lowest-order byte first, and last the
+fraction of the buffer, in 256ths, to fill with samples from before
+the trigger.
+
+The board records continuously, keeping the latest samples, until the
+trigger, then records enough samples after it to leave the chosen
+number from before it and stops. Nothing can be read with the get
+telemetry command until then; after that the whole capture is read
+the same way as streamed telemetry, and nothing more is recorded
+until a capture is armed again or telemetry set. A capture only
+disturbs the control loop as much as streaming at the same rate.*/
+
 //--------------------------------------------------
 //get firmware version
 //0x40
@@ -131,6 +541,224 @@ lowest-order (least significant) byte and going to the highest-order
 #define I2C_CMD_GET_MESSAGES 0x41
 /*This will return any messages on the controller.*/
 
+//--------------------------------------------------
+//get scheduler overruns
+//0x43
+#define I2C_CMD_GET_SCHED_OVERRUNS 0x43
+/*This will return three 16-bit ints, lowest-order byte first: the
+number of overruns of the 10kHz control group, the 1kHz supervision
+group and the 100Hz housekeeping group. A control overrun means a
+control tick took longer than the tick period; a supervision or
+housekeeping overrun means the main loop fell a whole period behind
+that group's deadline. The counters wrap and are never cleared.*/
+
+//--------------------------------------------------
+//get profile
+//0x44 B
+#define I2C_CMD_GET_PROFILE 0x44
+#define I2C_CMD_GET_PROFILE_BYTES 1
+/*This will return statistics for one of the built-in execution time
+probes, as four 16-bit ints, lowest-order byte first: the minimum,
+maximum and mean time in CPU cycles, and the number of samples in the
+mean. The low seven bits of the argument select the probe:
+
+0 the whole control interrupt
+1 sensors and controllers
+2 motor outputs
+3 LEDs
+4 digital debug output
+5 the TWI interrupt; nothing preempts it, so this is its cost
+6 the ADC conversion complete interrupt
+7 both channels' controllers, which is part of 1
+8 each time the firmware runs with interrupts off, other than to
+  read or count a counter; the longest a TWI byte can wait is its
+  maximum plus 5's
+
+If the highest-order bit of the argument is set, the probe's
+statistics are cleared after they are read. The mean only covers the
+most recent 16k-32k samples. The board has to be built with -DPROFILE
+for the probes to exist; otherwise this returns zeros.*/
+
+//--------------------------------------------------
+//get profile histogram
+//0x45 B
+#define I2C_CMD_GET_PROFILE_HISTOGRAM 0x45
+#define I2C_CMD_GET_PROFILE_HISTOGRAM_BYTES 1
+/*This will return the coarse histogram for a probe as four 16-bit
+ints, lowest-order byte first. The buckets are quarters of a control
+tick (0-25%, 25-50%, 50-75% and 75-100% of the tick) and saturate at
+65535. The argument is the same as for the get profile command.*/
+
+//--------------------------------------------------
+//get analog input
+//0x46 B
+#define I2C_CMD_GET_ANALOG 0x46
+#define I2C_CMD_GET_ANALOG_BYTES 1
+/*This will return two 16-bit ints, lowest-order byte first: the
+latest sample of analog input 1-6 (argument 0-5) in 12-bit ADC counts,
+and the number of complete sweeps of the inputs so far, which wraps.*/
+
+//--------------------------------------------------
+//get motion status
+//0x47 B
+#define I2C_CMD_GET_MOTION_STATUS 0x47
+#define I2C_CMD_GET_MOTION_STATUS_BYTES 1
+/*This will return seven bytes for the channel selected by the
+highest-order bit of the argument. The first is a status byte: bit 0
+is set while a move is running and bit 1 while another is waiting to
+start. Next is the controller's current target as a 32-bit int, then
+the time until all moves are done, in milliseconds, as a 16-bit int
+that saturates at 65535. Both are lowest-order byte first.*/
+
+//--------------------------------------------------
+//get path status
+//0x48 B
+#define I2C_CMD_GET_PATH_STATUS 0x48
+#define I2C_CMD_GET_PATH_STATUS_BYTES 1
+/*This will return six bytes for the channel selected by the
+highest-order bit of the argument. The first is a status byte: bit 0
+is set while the path is moving, bit 1 while there are waypoints it
+hasn't reached the start of yet, and bit 2 if a waypoint has been
+dropped since the path was last cleared. Next is the number of free
+waypoint slots, then the time buffered, in milliseconds, as a 16-bit
+int that saturates at 65535, then a 16-bit count of the times the path
+has run out of waypoints, which includes finishing and wraps. Both are
+lowest-order byte first.*/
+
+//--------------------------------------------------
+//get telemetry
+//0x49
+#define I2C_CMD_GET_TELEMETRY 0x49
+/*The read that follows is everything recorded since the last one: a
+byte giving the number of whole samples, a byte giving the number of
+bytes in each, then the samples, then zeros. A read can stop at any
+point; samples are only freed once all of their bytes have been read,
+so a sample cut short comes first again next time. This is the way to
+get data off the board at high rates without slowing the control
+loop.
+
+While a capture is armed or still recording after its trigger there
+is nothing to read yet; the count is zero with its highest-order bit
+set, which tells it apart from an empty buffer. The count of a
+finished capture or of streamed samples never has that bit set.*/
+
+//--------------------------------------------------
+//get telemetry status
+//0x4a
+#define I2C_CMD_GET_TELEMETRY_STATUS 0x4a
+/*This will return eight bytes about telemetry and captures: the state
+(0 for streaming or off, 1 for a capture waiting for its trigger, 2
+for one that has triggered, 3 for one that's done), the number of
+bytes in each sample, the number of samples the buffer can hold, the
+number it holds, the sequence number of the trigger sample as a
+16-bit int, and the size of the buffer in bytes as a 16-bit int, which
+is all the RAM recording uses. Both are lowest-order byte first.*/
+
+//--------------------------------------------------
+//registers
+//0x50 B [B ...]
+#define I2C_CMD_REGISTERS 0x50
+/*Read or write the register map. The byte after the command sets the
+register pointer; any bytes after that are written to the registers
+starting there, and a read that follows reads the registers starting
+there. The pointer moves on by one for every byte, so any run of
+registers can be read in one transaction, of any length, or written
+(up to the 68-byte limit on commands).
+
+Registers are little-endian. Multi-byte registers are latched: the
+whole value is copied when its first byte is read, so it can't change
+partway through, and a write only takes effect when its last byte
+arrives. A write that starts partway through a register is ignored,
+as are writes to read-only registers. Unused addresses read as zero.
+The target and the status registers are read from a copy of the
+control loop's state, taken when a register command is carried out
+and again every millisecond, so a value is always all from one tick,
+and a target just written reads back from the next tick on.
+
+Channel A's configuration is at 0x00 and channel B's at 0x20, so both
+channels can be configured with one write; channel A's status is at
+0x40 and B's at 0x60, and everything from 0x00 to 0x93 can be read at
+once.
+
+Registers hold values as the board keeps them, not as the commands
+send them: the target and move limits are integers and the gains are
+raw fixed point, where the commands take floats. A value reads back
+just as it was written. A gain written in the channel's current format
+keeps its value if the format register is changed after it; written
+after a format change, it's taken in the new format. Otherwise writing
+a register has the same effect as the matching command.
+
+  configuration, channel A at 0x00, channel B at 0x20, read/write
+  +0x00 mode        u8   as set motor sensor channel, bits 0-6
+  +0x01 format      u8   0 for Q16.16 gains, 1 for Q8.24
+  +0x04 target      i32  controller target, sensor units, integer
+  +0x08 P           i32  gains, raw fixed point in the channel's format,
+  +0x0c I           i32  so 1.0 is 0x00010000 in Q16.16 and 0x01000000
+  +0x10 D           i32  in Q8.24
+  +0x14 move vmax   u32  move limits, sensor units per second^n, integer;
+                         negative ones (as i32) are zero
+  +0x18 move amax   u32
+  +0x1c move jmax   u32
+
+  status, channel A at 0x40, channel B at 0x60, read only
+  +0x00 measured    i32  the channel's sensor, or zero if it has none
+  +0x04 duty        u16
+  +0x06 direction   u8   1 for reverse
+  +0x07 move status u8   as get motion status
+  +0x08 move left   u16  ms
+  +0x0a path status u8   as get path status
+  +0x0b path free   u8   waypoint slots
+  +0x0c path left   u16  ms
+  +0x0e path dry    u16
+
+  board, read only
+  0x80 overruns     u16  control, supervise and housekeeping groups
+  0x82              u16
+  0x84              u16
+  0x86 sweeps       u16  analog sweeps, wraps
+  0x88 analog       u16  inputs 1-6, 12-bit ADC counts
+  ...
+  0x92              u16
+
+  moves, read/write
+  0xa0 move A       i32  starts a move to here, reads the last one sent
+  0xa4 move B       i32*/
+
+/* register map, see I2C_CMD_REGISTERS */
+#define I2C_REG_CONFIG_A 0x00
+#define I2C_REG_CONFIG_B 0x20
+#define I2C_REG_STATUS_A 0x40
+#define I2C_REG_STATUS_B 0x60
+#define I2C_REG_CHANNEL_SIZE 0x20
+
+#define I2C_REG_MODE 0x00
+#define I2C_REG_FORMAT 0x01
+#define I2C_REG_TARGET 0x04
+#define I2C_REG_P 0x08
+#define I2C_REG_I 0x0c
+#define I2C_REG_D 0x10
+#define I2C_REG_MOVE_VELOCITY 0x14
+#define I2C_REG_MOVE_ACCELERATION 0x18
+#define I2C_REG_MOVE_JERK 0x1c
+
+#define I2C_REG_MEASURED 0x00
+#define I2C_REG_DUTY 0x04
+#define I2C_REG_DIRECTION 0x06
+#define I2C_REG_MOTION_STATUS 0x07
+#define I2C_REG_MOTION_LEFT 0x08
+#define I2C_REG_PATH_STATUS 0x0a
+#define I2C_REG_PATH_FREE 0x0b
+#define I2C_REG_PATH_LEFT 0x0c
+#define I2C_REG_PATH_DRY 0x0e
+
+#define I2C_REG_BOARD 0x80
+#define I2C_REG_OVERRUNS 0x80
+#define I2C_REG_ANALOG_SWEEPS 0x86
+#define I2C_REG_ANALOG 0x88
+#define I2C_REG_MOVE_A 0xa0
+#define I2C_REG_MOVE_B 0xa4
+#define I2C_REG_END 0xa8
+
 //--------------------------------------------------
 //get memory
 //0x42 B
@@ -0,0 +1,241 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "avr_compiler.h"
+#include "profile.h"
+#include "motion.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Planning (main loop)
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+static uint64_t div_ceil(uint64_t n, uint64_t d)
+{
+    return (n + d - 1) / d;
+}
+
+/* smallest r with r*r >= x */
+static uint64_t isqrt_ceil(uint64_t x)
+{
+    uint64_t r = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > x)
+        bit >>= 2;
+    while (bit)
+    {
+        if (x >= r + bit)
+        {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+            r >>= 1;
+        bit >>= 2;
+    }
+    return r + (x != 0);
+}
+
+/* Fill in a plan from start to target within the limits. Returns false
+ * if there's nothing to do or the limits don't allow a move. The
+ * tick counts are rounded up, which can only lower the velocity and
+ * acceleration actually used. */
+static bool motion_plan(motion_plan_t* p, const motion_t* m,
+                        int32_t start, int32_t target, uint16_t rate)
+{
+    int64_t dist = (int64_t)target - start;
+    uint64_t d = dist < 0 ? -dist : dist;
+    uint64_t na, nc, nj;
+    uint64_t v, a;
+    int64_t j;
+
+    if (d == 0 || d > MOTION_DISTANCE_MAX || m->vmax == 0 || m->amax == 0)
+        return false;
+
+    /* ticks to reach vmax; if the move is over before then it's a
+     * triangle, with the acceleration phase as long as amax allows */
+    na = div_ceil((uint64_t)m->vmax * rate, m->amax);
+    if (d * rate <= (uint64_t)m->vmax * na)
+    {
+        na = isqrt_ceil(div_ceil(d * rate * rate, m->amax));
+        nc = 0;
+    }
+    else
+        nc = div_ceil(d * rate, m->vmax) - na;
+    nj = m->jmax ? div_ceil((uint64_t)m->amax * rate, m->jmax) : 1;
+
+    /* the distance covered is exactly v * (na + nc) */
+    v = (d << 32) / (na + nc);
+    a = v / na;
+    j = (int64_t)(a / nj);
+    if (dist < 0)
+        j = -j;
+
+    p->start = start;
+    p->target = target;
+    p->nj = nj;
+    p->edge[0] = 0;
+    p->jerk[0] = j;
+    p->edge[1] = na;
+    p->jerk[1] = -j;
+    p->edge[2] = na + nc;
+    p->jerk[2] = -j;
+    p->edge[3] = 2 * na + nc;
+    p->jerk[3] = j;
+    p->length = 2 * na + nc + nj - 1;
+    return true;
+}
+
+void motion_init(motion_t* m)
+{
+    memset(m, 0, sizeof(motion_t));
+}
+
+/* from the command decoder, in the main loop with the control
+ * interrupts held off */
+void motion_request(motion_t* m, int32_t target)
+{
+    m->request = target;
+    m->requested = true;
+}
+
+/* from the command decoder, like motion_request(): stop generating
+ * setpoints where we are and forget anything queued or about to be */
+void motion_cancel(motion_t* m)
+{
+    m->requested = false;
+    m->epoch++;
+    m->queued = false;
+    m->active = false;
+}
+
+/* Plan a requested move, in the main loop. It starts where the running
+ * move will end, or at *setpoint (the controller's target) if nothing
+ * is running. The request is copied with the same retry as
+ * pid_prepare(); the start is read and the plan queued with interrupts
+ * off, and not queued at all if the move was cancelled meanwhile. */
+void motion_prepare(motion_t* m, const int32_t* setpoint, uint16_t rate)
+{
+    int32_t target;
+    int32_t start;
+    uint8_t epoch;
+    bool ok;
+
+    while (m->requested)
+    {
+        m->requested = false;
+        target = m->request;
+        if (m->requested)
+            continue;
+
+        {
+            PROF_ENTER_CRITICAL_REGION();
+            m->queued = false;
+            start = m->active ? m->plans[m->plan_idx].target : *setpoint;
+            epoch = m->epoch;
+            PROF_LEAVE_CRITICAL_REGION();
+        }
+
+        ok = motion_plan(&m->plans[!m->plan_idx], m, start, target, rate);
+
+        {
+            PROF_ENTER_CRITICAL_REGION();
+            if (ok && epoch == m->epoch && !m->requested)
+                m->queued = true;
+            PROF_LEAVE_CRITICAL_REGION();
+        }
+    }
+}
+
+/* ticks until the running and queued moves are done, for status */
+uint32_t motion_remaining(motion_t* m)
+{
+    uint32_t left = 0;
+
+    PROF_ENTER_CRITICAL_REGION();
+    if (m->active)
+        left += m->plans[m->plan_idx].length - m->tick;
+    if (m->queued)
+        left += m->plans[!m->plan_idx].length;
+    PROF_LEAVE_CRITICAL_REGION();
+    return left;
+}
+
+uint8_t motion_status(motion_t* m)
+{
+    return (m->active ? MOTION_ACTIVE : 0)
+        | (m->queued || m->requested ? MOTION_WAITING : 0);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Profile (control tick)
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Advance the profile one tick. Returns whether there's a new
+ * setpoint; when there isn't, the controller keeps the last one. */
+uint8_t motion_update(motion_t* m)
+{
+    const motion_plan_t* p;
+    int64_t jerk = 0;
+    uint8_t i;
+
+    if (!m->active)
+    {
+        if (!m->queued)
+            return false;
+        m->plan_idx = !m->plan_idx;
+        m->queued = false;
+        m->active = true;
+        m->tick = 0;
+        m->pos = (int64_t)m->plans[m->plan_idx].start << 32;
+        m->vel = 0;
+        m->acc = 0;
+    }
+    p = &m->plans[m->plan_idx];
+
+    /* each edge applies its jerk for nj ticks from its start */
+    for (i = 0; i < MOTION_EDGES; i++)
+        if (m->tick - p->edge[i] < p->nj)
+            jerk += p->jerk[i];
+
+    m->acc += jerk;
+    m->vel += m->acc;
+    m->pos += m->vel;
+
+    if (++m->tick >= p->length)
+    {
+        m->setpoint = p->target;
+        m->active = false;
+    }
+    else
+        m->setpoint = (int32_t)((m->pos + ((int64_t)1 << 31)) >> 32);
+    return true;
+}
@@ -0,0 +1,113 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Onboard trajectory generation for position moves. A move is planned
+ * in the main loop by motion_prepare() and only integrated in the
+ * control tick, which costs three 64-bit adds per tick:
+ *
+ *   acc += jerk;  vel += acc;  pos += vel;
+ *
+ * The plan is a trapezoid: accelerate for na ticks, cruise for nc,
+ * decelerate for na. The cruise velocity is chosen so that the move
+ * lands exactly on the target. For an S-curve the trapezoid's
+ * acceleration is passed through a moving average nj ticks long. That
+ * turns each step in acceleration into a ramp at the jerk limit and
+ * makes the move nj ticks longer, but doesn't change the distance
+ * covered. A trapezoid is the same thing with nj = 1. The four steps
+ * in acceleration are stored as the tick they start at and the jerk
+ * to apply for nj ticks from then.
+ *
+ * Positions are Q32.32 counts, velocities Q32.32 counts per tick and
+ * accelerations Q32.32 counts per tick per tick. The profile is
+ * snapped to the target at the end, so rounding never leaves a move
+ * short.
+ *
+ * A move sent while another is running is queued and starts where
+ * that one ends; a move sent while one is already queued replaces it.
+ * Limits and requests are written by the command decoder and plans
+ * made from them, both in the main loop, and the control tick switches
+ * plans with a single byte write, like the PID's coefficients. */
+
+#define MOTION_EDGES 4
+
+/* motion_status() bits */
+#define MOTION_ACTIVE 0x01          /* a move is running */
+#define MOTION_WAITING 0x02         /* and another is waiting to start */
+
+/* moves longer than this many counts are refused */
+#define MOTION_DISTANCE_MAX INT32_MAX
+
+typedef struct {
+    int32_t start;
+    int32_t target;
+    uint32_t length;            /* ticks */
+    uint32_t nj;
+    uint32_t edge[MOTION_EDGES];
+    int64_t jerk[MOTION_EDGES];
+} motion_plan_t;
+
+typedef struct {
+    /* limits, in counts/s, counts/s^2 and counts/s^3; jerk 0 means a
+     * trapezoid */
+    uint32_t vmax;
+    uint32_t amax;
+    uint32_t jmax;
+
+    /* a move waiting to be planned */
+    int32_t request;
+    volatile uint8_t requested;
+    volatile uint8_t epoch;     /* bumped by motion_cancel() */
+
+    motion_plan_t plans[2];
+    volatile uint8_t plan_idx;  /* the plan the tick runs */
+    volatile uint8_t queued;    /* plans[!plan_idx] is ready to start */
+    volatile uint8_t active;    /* plans[plan_idx] is running */
+
+    /* profile state, only touched by the tick */
+    uint32_t tick;
+    int64_t pos;
+    int64_t vel;
+    int64_t acc;
+    int32_t setpoint;
+} motion_t;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void motion_init(motion_t* m);
+void motion_request(motion_t* m, int32_t target);
+void motion_cancel(motion_t* m);
+void motion_prepare(motion_t* m, const int32_t* setpoint, uint16_t rate);
+uint8_t motion_update(motion_t* m);
+uint32_t motion_remaining(motion_t* m);
+uint8_t motion_status(motion_t* m);
+
+#endif /* MOTION_H */
@@ -0,0 +1,92 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "output.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Output stage
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* no limits, coasting: the drive follows the command, but still
+ * stops for a tick on the way through zero */
+void output_init(output_t* o)
+{
+    o->slew = 0;
+    o->deadband = 0;
+    o->brake = false;
+    o->drive = 0;
+    o->hold = 0;
+    o->reverse = false;
+}
+
+void output_configure(output_t* o, uint16_t slew, uint8_t deadband,
+                      uint8_t brake)
+{
+    o->slew = slew;
+    o->deadband = deadband;
+    o->brake = brake;
+    o->hold = 0;
+}
+
+/* Called from the control tick with the channel's command, which is
+ * within a duty cycle of zero, so none of this can overflow. Returns
+ * the new drive. */
+int32_t output_update(output_t* o, int32_t command)
+{
+    int32_t next = command;
+
+    if (o->slew)
+    {
+        if (next > o->drive + o->slew)
+            next = o->drive + o->slew;
+        else if (next < o->drive - o->slew)
+            next = o->drive - o->slew;
+    }
+
+    if (o->drive == 0)
+    {
+        /* waiting out the dead-band; carrying on the way it was
+         * going isn't a reversal and needn't wait */
+        if (o->hold)
+        {
+            o->hold--;
+            if (next != 0 && (next < 0) != o->reverse)
+                next = 0;
+        }
+    }
+    else if ((next ^ o->drive) < 0 || next == 0)
+    {
+        /* stopping, or about to change direction: stop first */
+        next = 0;
+        o->hold = o->deadband;
+        o->reverse = o->drive < 0;
+    }
+
+    o->drive = next;
+    return next;
+}
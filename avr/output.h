@@ -0,0 +1,63 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* The output stage sits between a channel's command, a signed duty
+ * cycle from the controller or the master, and the bridge. Once per
+ * control tick output_update() moves the drive toward the command by
+ * no more than slew. A change of sign always passes through zero and
+ * then waits deadband ticks there before driving the other way, with
+ * the bridge braking or coasting as brake says, which is also what it
+ * does whenever the drive is zero. The slew limit and the dead-band
+ * are what keep a reversal from putting a current spike through the
+ * bridge. Mapping the drive onto the PWM period and the direction
+ * pins is the caller's business.
+ *
+ * The settings are written by the I2C decode with the control
+ * interrupts held off. */
+
+typedef struct {
+    uint16_t slew;              /* largest change per tick, 0 for none */
+    uint8_t deadband;           /* ticks at zero when reversing */
+    uint8_t brake;              /* short the motor at zero, else coast */
+    int32_t drive;              /* what the bridge is being given */
+    uint8_t hold;               /* dead-band ticks still to wait */
+    uint8_t reverse;            /* which way it went before zero */
+} output_t;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void output_init(output_t* o);
+void output_configure(output_t* o, uint16_t slew, uint8_t deadband,
+                      uint8_t brake);
+int32_t output_update(output_t* o, int32_t command);
+
+#endif /* OUTPUT_H */
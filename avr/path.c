@@ -0,0 +1,286 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "avr_compiler.h"
+#include "profile.h"
+#include "path.h"
+
+#define PATH_MASK (PATH_SLOTS - 1)
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Waypoints (command decoder)
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void path_init(path_t* p)
+{
+    memset(p, 0, sizeof(path_t));
+}
+
+/* Returns false, and remembers that it did, if the ring is full. */
+uint8_t path_push(path_t* p, int32_t pos, uint16_t dt, uint8_t flags)
+{
+    waypoint_t* w;
+
+    if ((uint8_t)(p->head - p->tail) >= PATH_SLOTS)
+    {
+        p->overflow = true;
+        return false;
+    }
+    w = &p->ring[p->head & PATH_MASK];
+    w->pos = pos;
+    w->dt = dt;
+    w->flags = flags;
+    p->head++;
+    return true;
+}
+
+/* stop where we are and forget every waypoint */
+void path_clear(path_t* p)
+{
+    p->epoch++;
+    p->tail = p->head;
+    p->overflow = false;
+    p->queued = false;
+    p->active = false;
+}
+
+uint8_t path_free(path_t* p)
+{
+    return PATH_SLOTS - (uint8_t)(p->head - p->tail);
+}
+
+/* ticks left in the segments the tick has, running and queued; from
+ * the tick, or with interrupts off */
+uint32_t path_running(path_t* p)
+{
+    uint32_t left = 0;
+
+    if (p->active)
+        left += p->segs[p->seg_idx].length - p->tick;
+    if (p->queued)
+        left += p->segs[!p->seg_idx].length;
+    return left;
+}
+
+/* ticks of waypoints not yet planned into a segment */
+uint32_t path_buffered(path_t* p)
+{
+    uint32_t left = 0;
+    uint8_t i;
+
+    for (i = p->tail; i != p->head; i++)
+        left += p->ring[i & PATH_MASK].dt;
+    return left;
+}
+
+/* ticks of path buffered, including the segment running */
+uint32_t path_remaining(path_t* p)
+{
+    uint32_t left;
+
+    PROF_ENTER_CRITICAL_REGION();
+    left = path_running(p);
+    PROF_LEAVE_CRITICAL_REGION();
+    return left + path_buffered(p);
+}
+
+uint8_t path_status(path_t* p)
+{
+    return (p->active ? PATH_ACTIVE : 0)
+        | (p->queued || p->head != p->tail ? PATH_WAITING : 0)
+        | (p->overflow ? PATH_OVERFLOW : 0);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Planning (main loop)
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+static int32_t path_step(int32_t from, int32_t to, int32_t max)
+{
+    int64_t d = (int64_t)to - from;
+
+    if (d > max) return max;
+    if (d < -max) return -max;
+    return (int32_t)d;
+}
+
+static uint16_t path_dt(uint16_t dt)
+{
+    if (dt == 0) return 1;
+    if (dt > PATH_DT_MAX) return PATH_DT_MAX;
+    return dt;
+}
+
+/* Fill in a segment from start to waypoint w, starting with slope m0.
+ * Returns the slope it ends with. Steps and dts out of range are
+ * clamped, so the sums below stay under 2^61.
+ *
+ * With s the mean slope, the cubic that leaves with slope m0 and
+ * arrives with m1 after n ticks is
+ *
+ *   p(t) = start + m0 t + c t^2 + d t^3
+ *   c = (3s - 2 m0 - m1) / n,  d = (m0 + m1 - 2s) / n^2
+ *
+ * and a line is the same with m0 = m1 = s. */
+static int64_t path_plan(path_seg_t* seg, int32_t start, int64_t m0,
+                         const waypoint_t* w, const waypoint_t* next)
+{
+    int32_t n = path_dt(w->dt);
+    int32_t step = path_step(start, w->pos, PATH_STEP_MAX);
+    int64_t s = ((int64_t)step << 32) / n;
+    int64_t m1, c, d3;
+
+    seg->start = start;
+    seg->end = start + step;
+    seg->length = n;
+
+    if (!(w->flags & PATH_CUBIC))
+    {
+        seg->d1 = s;
+        seg->d2 = 0;
+        seg->d3 = 0;
+        return s;
+    }
+
+    if (next == 0)
+        m1 = 0;
+    else if (next->flags & PATH_CUBIC)
+        m1 = ((int64_t)path_step(start, next->pos, 2 * PATH_STEP_MAX) << 32)
+            / (n + path_dt(next->dt));
+    else                        /* run straight into the line */
+        m1 = ((int64_t)path_step(seg->end, next->pos, PATH_STEP_MAX) << 32)
+            / path_dt(next->dt);
+
+    c = (3 * s - 2 * m0 - m1) / n;
+    d3 = 6 * (m0 + m1 - 2 * s) / ((int64_t)n * n);
+    seg->d1 = m0 + c + d3 / 6;
+    seg->d2 = 2 * c + d3;
+    seg->d3 = d3;
+    return m1;
+}
+
+/* Plan the oldest waypoint, in the main loop, if the tick doesn't
+ * already have a segment waiting. It starts from the last segment
+ * planned, or from *setpoint (the controller's target) at rest if the
+ * tick isn't running one. The waypoints are copied and the plan queued
+ * with interrupts off, and it's dropped if the path was cleared in
+ * between, like motion_prepare(). */
+void path_prepare(path_t* p, const int32_t* setpoint)
+{
+    waypoint_t w, next;
+    uint8_t tail, epoch, more;
+    int32_t start;
+    int64_t m0, m1;
+
+    if (p->queued)
+        return;
+
+    {
+        PROF_ENTER_CRITICAL_REGION();
+        tail = p->tail;
+        more = (uint8_t)(p->head - tail);
+        w = p->ring[tail & PATH_MASK];
+        next = p->ring[(tail + 1) & PATH_MASK];
+        epoch = p->epoch;
+        if (p->active)
+        {
+            start = p->last_pos;
+            m0 = p->last_slope;
+        }
+        else
+        {
+            start = *setpoint;
+            m0 = 0;
+        }
+        PROF_LEAVE_CRITICAL_REGION();
+    }
+    if (more == 0)
+        return;
+
+    m1 = path_plan(&p->segs[!p->seg_idx], start, m0, &w,
+                   more > 1 ? &next : 0);
+
+    {
+        PROF_ENTER_CRITICAL_REGION();
+        if (epoch == p->epoch)
+        {
+            p->last_pos = p->segs[!p->seg_idx].end;
+            p->last_slope = m1;
+            p->tail = tail + 1;
+            p->queued = true;
+        }
+        PROF_LEAVE_CRITICAL_REGION();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Interpolation (control tick)
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Advance the path one tick. Returns whether there's a new setpoint;
+ * when there isn't, the controller keeps the last one. */
+uint8_t path_update(path_t* p)
+{
+    const path_seg_t* s;
+
+    if (!p->active)
+    {
+        if (!p->queued)
+            return false;
+        p->seg_idx = !p->seg_idx;
+        p->queued = false;
+        p->active = true;
+        p->tick = 0;
+        s = &p->segs[p->seg_idx];
+        p->pos = (int64_t)s->start << 32;
+        p->d1 = s->d1;
+        p->d2 = s->d2;
+    }
+    s = &p->segs[p->seg_idx];
+
+    p->pos += p->d1;
+    p->d1 += p->d2;
+    p->d2 += s->d3;
+
+    if (++p->tick >= s->length)
+    {
+        /* the next segment, if it's ready, starts next tick */
+        p->setpoint = s->end;
+        p->active = false;
+        if (!p->queued)
+            p->dry++;
+    }
+    else
+        p->setpoint = (int32_t)((p->pos + ((int64_t)1 << 31)) >> 32);
+    return true;
+}
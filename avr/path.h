@@ -0,0 +1,123 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef PATH_H
+#define PATH_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Continuous paths from timestamped waypoints. The host queues
+ * waypoints, each a position and the number of control ticks after the
+ * one before that it should be reached, and the control tick
+ * interpolates between them, linearly or with a cubic Hermite curve.
+ *
+ * The command decoder puts waypoints in a ring, and then the main loop
+ * turns the oldest into a segment one ahead of the tick, the same way moves are
+ * planned: a cubic's tangent at its end is the Catmull-Rom one through
+ * the waypoints either side, or zero if there's no waypoint after it
+ * yet, so a path the host stops feeding comes to rest at its last
+ * waypoint. A cubic after a linear segment starts with its slope, and
+ * a path from rest starts from rest. Segments are stored as forward
+ * differences, so the tick does three 64-bit adds whatever the degree:
+ *
+ *   pos += d1;  d1 += d2;  d2 += d3;
+ *
+ * and snaps to the waypoint at the end of the segment.
+ *
+ * If the tick finishes a segment and the next isn't ready it holds the
+ * last waypoint and counts a run-dry; time stops until there's another
+ * waypoint, and the path carries on from there with the full dt. */
+
+#define PATH_SLOTS 16               /* waypoints buffered, power of two */
+#define PATH_DT_MAX 2048            /* ticks; longer gets rounding error */
+#define PATH_STEP_MAX ((int32_t)1 << 24) /* counts between waypoints */
+
+/* waypoint flags */
+#define PATH_CUBIC 0x01
+
+/* path_status() bits */
+#define PATH_ACTIVE 0x01            /* a segment is running */
+#define PATH_WAITING 0x02           /* and there are more to come */
+#define PATH_OVERFLOW 0x04          /* a waypoint was dropped */
+
+typedef struct {
+    int32_t pos;
+    uint16_t dt;                /* ticks after the previous waypoint */
+    uint8_t flags;
+} waypoint_t;
+
+typedef struct {
+    int32_t start;
+    int32_t end;
+    uint16_t length;            /* ticks */
+    int64_t d1;                 /* forward differences, Q32.32 counts */
+    int64_t d2;
+    int64_t d3;
+} path_seg_t;
+
+typedef struct {
+    /* written by the command decoder, read by the planner after it,
+     * both in the main loop; head and tail count up forever and are
+     * masked to index */
+    waypoint_t ring[PATH_SLOTS];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    volatile uint8_t epoch;     /* bumped by path_clear() */
+    volatile uint8_t overflow;  /* a waypoint was dropped */
+    volatile uint16_t dry;      /* times the tick ran out of segments */
+
+    /* the end of the last segment planned, main loop only */
+    int32_t last_pos;
+    int64_t last_slope;         /* Q32.32 counts per tick */
+
+    path_seg_t segs[2];
+    volatile uint8_t seg_idx;   /* the segment the tick runs */
+    volatile uint8_t queued;    /* segs[!seg_idx] is ready to start */
+    volatile uint8_t active;    /* segs[seg_idx] is running */
+
+    /* interpolator state, only touched by the tick */
+    uint16_t tick;
+    int64_t pos;
+    int64_t d1;
+    int64_t d2;
+    int32_t setpoint;
+} path_t;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void path_init(path_t* p);
+uint8_t path_push(path_t* p, int32_t pos, uint16_t dt, uint8_t flags);
+void path_clear(path_t* p);
+uint8_t path_free(path_t* p);
+uint32_t path_running(path_t* p);
+uint32_t path_buffered(path_t* p);
+uint32_t path_remaining(path_t* p);
+uint8_t path_status(path_t* p);
+void path_prepare(path_t* p, const int32_t* setpoint);
+uint8_t path_update(path_t* p);
+
+#endif /* PATH_H */
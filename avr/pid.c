@@ -0,0 +1,180 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "fixed.h"
+#include "pid.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// PID
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void pid_init(controller_t* c, uint8_t q, uint16_t rate,
+              int32_t out_min, int32_t out_max)
+{
+    c->P = 0;
+    c->I = 0;
+    c->D = 0;
+    c->q = q;
+    c->rate = rate;
+    c->coef_idx = 0;
+    c->target = 0;
+    c->out_min = out_min;
+    c->out_max = out_max;
+    c->dirty = true;
+    pid_prepare(c);
+    pid_reset(c);
+}
+
+/* forget accumulated state but keep gains and target */
+void pid_reset(controller_t* c)
+{
+    c->e_last = 0;
+    c->e_prev = 0;
+    c->e_cur = 0;
+    c->u = 0;
+    c->target_last = c->target;
+}
+
+/* Switch the gains to a different fractional format without changing
+ * their value (beyond the precision lost going down). The tick keeps
+ * running on the coefficients it has, in the old format, until
+ * pid_prepare() swaps in a set worked out from these. */
+void pid_set_format(controller_t* c, uint8_t q)
+{
+    c->P = fix_requant(c->P, c->q, q);
+    c->I = fix_requant(c->I, c->q, q);
+    c->D = fix_requant(c->D, c->q, q);
+    c->q = q;
+    c->dirty = true;
+}
+
+void pid_set_rate(controller_t* c, uint16_t rate)
+{
+    c->rate = rate;
+    c->dirty = true;
+}
+
+/* Recompute the discrete coefficients if anything changed. Called from
+ * the main loop, never from the control tick. The gains are written by
+ * the command decoder, which runs in the main loop before this, so
+ * they don't change while we're copying them; anything that writes
+ * them sets dirty after, though, so if dirty is set again by the time
+ * we're done we throw the result away and go around again. */
+void pid_prepare(controller_t* c)
+{
+    fix_t P, I, D;
+    uint8_t q;
+    int32_t rate;
+    pid_coefs_t* next;
+    int64_t i_dt, d_rate;
+
+    while (c->dirty)
+    {
+        c->dirty = false;
+        P = c->P;
+        I = c->I;
+        D = c->D;
+        q = c->q;
+        rate = c->rate ? c->rate : 1;
+
+        i_dt = I / rate;                /* Ki * dt */
+        d_rate = (int64_t)D * rate;     /* Kd / dt */
+
+        if (c->dirty)
+            continue;
+
+        next = &c->coefs[!c->coef_idx];
+        next->a0 = fix_sat((int64_t)P + i_dt + d_rate);
+        next->a1 = fix_sat(-(int64_t)P - 2 * d_rate);
+        next->a2 = fix_sat(d_rate);
+        next->kp = P;
+        next->q = q;
+        c->coef_idx = !c->coef_idx;
+    }
+}
+
+/* a sum of products of a coefficient set, in the accumulator's
+ * format; q is only ever one of two values, so this is a constant
+ * shift */
+static int64_t pid_widen(int64_t x, uint8_t q)
+{
+    return q == FIX_Q16 ? x << (PID_U_Q - FIX_Q16) : x;
+}
+
+/* an error, or a change in one, as the 16-bit int the update
+ * multiplies by */
+static int16_t pid_clamp(int32_t e)
+{
+    return (int16_t)fix_clamp(e, -PID_ERROR_MAX, PID_ERROR_MAX);
+}
+
+/* Called from the control loop once per tick: three 32x16 bit
+ * multiply-accumulates and a clamp, no division, no 64-bit multiply,
+ * no variable shift and no floating point.
+ *
+ * The clamp is also the anti-windup. There is no integrator to wind
+ * up; the only state is the output accumulator, and clamping that to
+ * the output range means a saturated output starts coming back the
+ * moment the error changes sign. It's the same comparison that limits
+ * the output, so it costs nothing extra in the steady state. */
+int32_t pid_update(controller_t* c, int32_t measurement)
+{
+    const pid_coefs_t* k = &c->coefs[c->coef_idx];
+    int64_t lo = (int64_t)c->out_min << PID_U_Q;
+    int64_t hi = (int64_t)c->out_max << PID_U_Q;
+    int64_t u;
+
+    /* only when the target has moved: re-reference the history to the
+     * new target and add the proportional step by hand */
+    if (c->target != c->target_last)
+    {
+        int32_t step = fix_sub(c->target, c->target_last);
+        c->e_cur = pid_clamp(fix_add(c->e_cur, step));
+        c->e_last = pid_clamp(fix_add(c->e_last, step));
+        c->u += pid_widen(fix_mul_32x16(k->kp, pid_clamp(step)), k->q);
+        c->target_last = c->target;
+    }
+
+    c->e_prev = c->e_last;
+    c->e_last = c->e_cur;
+    c->e_cur = pid_clamp(fix_sub(c->target, measurement));
+
+    /* each product is under 2^47, 2^55 moved up, and u is clamped to
+     * under 2^41, so this sum can't overflow even with the
+     * proportional step above */
+    u = c->u
+        + pid_widen(fix_mul_32x16(k->a0, c->e_cur)
+                    + fix_mul_32x16(k->a1, c->e_last)
+                    + fix_mul_32x16(k->a2, c->e_prev), k->q);
+
+    if (u > hi) u = hi;
+    if (u < lo) u = lo;
+    c->u = u;
+
+    return (int32_t)(u >> PID_U_Q);
+}
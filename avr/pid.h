@@ -0,0 +1,109 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+#include "fixed.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* stores PID settings and other controller state */
+
+/* Signals (target, measurement, errors, output) are plain integers in
+ * whatever units the channel's sensor reports. The gains are fix_t
+ * with q fractional bits; q is chosen per channel so that a motor with
+ * small gains can use Q8.24 and one with large gains Q16.16.
+ *
+ * The controller runs in velocity (incremental) form:
+ *
+ *   u[k] = u[k-1] + a0*e[k] + a1*e[k-1] + a2*e[k-2]
+ *
+ * P is unitless, I is per second and D is in seconds. The discrete
+ * coefficients a0..a2 have the loop period folded in and are only
+ * recomputed by pid_prepare() from the main loop when a gain or the
+ * rate has changed, so the control tick never multiplies by dt. There
+ * are two coefficient sets; pid_prepare() fills the one the tick isn't
+ * using and then flips coef_idx, which is a single byte write. Each
+ * set carries its own format, so a format change takes effect with
+ * the coefficients it goes with. The output accumulator is always
+ * Q.24 whatever the format, and products of Q16.16 coefficients are
+ * moved up 8 bits to match, so the accumulator never has to be
+ * rescaled.
+ *
+ * A target change is applied to the error history as well, so the
+ * derivative acts on the measurement alone, and the proportional
+ * step kp*(change) is added to u directly. Otherwise a step in the
+ * target kicks u into the output clamp through a0 and straight back
+ * out the other side through a1, and the clamp forgets which way the
+ * motor should be going. */
+/* Errors are clamped to a 16-bit int, so each term of the update is a
+ * 32x16 bit multiply (fix_mul_32x16()) and the sums stay within 48
+ * bits. A channel's error saturates at +-32767 sensor units; with any
+ * gain of 2 or more that's already full duty. */
+#define PID_ERROR_MAX INT16_MAX
+
+/* fractional bits of the output accumulator */
+#define PID_U_Q FIX_Q24
+
+typedef struct {
+    fix_t a0;
+    fix_t a1;
+    fix_t a2;
+    fix_t kp;
+    uint8_t q;                  /* fractional bits of this set */
+} pid_coefs_t;
+
+typedef struct {
+    fix_t P;
+    fix_t I;
+    fix_t D;
+    uint8_t q;                  /* fractional bits of gains and coefs */
+    uint16_t rate;              /* control loop rate, Hz */
+    volatile uint8_t dirty;     /* gains or rate changed since prepare */
+    pid_coefs_t coefs[2];
+    volatile uint8_t coef_idx;  /* the set pid_update() uses */
+    int16_t e_last;
+    int16_t e_prev;
+    int16_t e_cur;
+    int64_t u;                  /* output accumulator, PID_U_Q */
+    int32_t target;
+    int32_t target_last;        /* target the error history is against */
+    int32_t out_min;
+    int32_t out_max;
+} controller_t;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void pid_init(controller_t* c, uint8_t q, uint16_t rate,
+              int32_t out_min, int32_t out_max);
+void pid_reset(controller_t* c);
+void pid_set_format(controller_t* c, uint8_t q);
+void pid_set_rate(controller_t* c, uint16_t rate);
+void pid_prepare(controller_t* c);
+int32_t pid_update(controller_t* c, int32_t measurement);
+
+#endif /* PID_H */
@@ -0,0 +1,108 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "avr_compiler.h"
+#include "hal/hal.h"
+#include "profile.h"
+
+#ifdef PROFILE
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Profiler
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+static prof_stats_t prof_stats[PROF_COUNT];
+static uint16_t prof_period;
+
+/* period is the number of clock 1 ticks per control tick */
+void prof_init(uint16_t period)
+{
+    prof_period = period;
+    for (uint8_t i = 0; i < PROF_COUNT; i++)
+    {
+        memset(&prof_stats[i], 0, sizeof(prof_stats_t));
+        prof_stats[i].min = 0xffff;
+    }
+}
+
+uint16_t prof_timestamp(void)
+{
+    return hal_tick_count();
+}
+
+void prof_record(uint8_t id, uint16_t start)
+{
+    uint16_t end = prof_timestamp();
+    uint16_t d;
+    uint8_t b;
+    prof_stats_t* s = &prof_stats[id];
+
+    /* the counter wraps once per control period */
+    d = (end >= start) ? end - start : end + prof_period - start;
+
+    AVR_ENTER_CRITICAL_REGION();
+    if (d < s->min) s->min = d;
+    if (d > s->max) s->max = d;
+
+    if (s->count == PROF_COUNT_MAX)
+    {
+        s->sum >>= 1;
+        s->count >>= 1;
+    }
+    s->sum += d;
+    s->count++;
+
+    if (d < (prof_period >> 2))      b = 0;
+    else if (d < (prof_period >> 1)) b = 1;
+    else if (d < prof_period - (prof_period >> 2)) b = 2;
+    else b = 3;
+    if (s->hist[b] != 0xffff)
+        s->hist[b]++;
+    AVR_LEAVE_CRITICAL_REGION();
+}
+
+/* copy out one probe's statistics, optionally clearing them */
+void prof_read(uint8_t id, prof_stats_t* out, uint8_t clear)
+{
+    if (id >= PROF_COUNT)
+    {
+        memset(out, 0, sizeof(prof_stats_t));
+        return;
+    }
+
+    AVR_ENTER_CRITICAL_REGION();
+    memcpy(out, &prof_stats[id], sizeof(prof_stats_t));
+    if (clear)
+    {
+        memset(&prof_stats[id], 0, sizeof(prof_stats_t));
+        prof_stats[id].min = 0xffff;
+    }
+    AVR_LEAVE_CRITICAL_REGION();
+}
+
+#endif /* PROFILE */
@@ -0,0 +1,101 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Execution time profiler
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Build with -DPROFILE to get these. Each probe takes a timestamp from
+ * clock 1's counter on the way in and another on the way out, and
+ * keeps the min, max and running mean of the difference plus a coarse
+ * histogram. Clock 1 ticks at half the CPU clock and wraps once per
+ * control tick, so a single measurement can't be longer than one
+ * control period; anything that long is also counted as a scheduler
+ * overrun. Times are reported in CPU cycles.
+ *
+ * A probe in a low-priority interrupt also counts any time spent in
+ * higher-priority interrupts that preempted it, which is what you
+ * want for service latency but not for cost.
+ *
+ * Without -DPROFILE the probes compile to nothing. */
+
+typedef enum {
+    PROF_CONTROL_ISR = 0,       /* the whole clock 1 interrupt */
+    PROF_SENSORS = 1,
+    PROF_MOTORS = 2,
+    PROF_LEDS = 3,
+    PROF_DIGOUT = 4,
+    PROF_TWI_ISR = 5,
+    PROF_ADC_ISR = 6,
+    PROF_CONTROLLERS = 7,       /* both channels' controllers, inside 1 */
+    PROF_IRQ_OFF = 8,           /* stretches with interrupts off */
+    PROF_COUNT = 9,
+} prof_probe_e;
+
+/* histogram buckets are quarters of a control period */
+#define PROF_HIST_BUCKETS 4
+
+/* once this many samples are in the mean, halve sum and count so the
+ * mean tracks recent behaviour and the sum can't overflow */
+#define PROF_COUNT_MAX 0x8000
+
+typedef struct {
+    uint16_t min;               /* in clock 1 ticks */
+    uint16_t max;
+    uint32_t sum;
+    uint16_t count;
+    uint16_t hist[PROF_HIST_BUCKETS];
+} prof_stats_t;
+
+#ifdef PROFILE
+
+#define PROF_ENTER(id) uint16_t prof_start_##id = prof_timestamp()
+#define PROF_EXIT(id) prof_record((id), prof_start_##id)
+
+/* AVR_ENTER_CRITICAL_REGION and AVR_LEAVE_CRITICAL_REGION for the
+ * longer stretches with interrupts off, the ones that copy more than a
+ * counter. Those are what the TWI interrupt can wait behind, so
+ * the worst case time to service a byte is this probe's maximum plus
+ * PROF_TWI_ISR's. The stretch is recorded before interrupts go back
+ * on, so the recording isn't counted but does lengthen it a little. */
+#define PROF_ENTER_CRITICAL_REGION() AVR_ENTER_CRITICAL_REGION(); \
+    PROF_ENTER(PROF_IRQ_OFF)
+#define PROF_LEAVE_CRITICAL_REGION() PROF_EXIT(PROF_IRQ_OFF); \
+    AVR_LEAVE_CRITICAL_REGION()
+
+void prof_init(uint16_t period);
+uint16_t prof_timestamp(void);
+void prof_record(uint8_t id, uint16_t start);
+void prof_read(uint8_t id, prof_stats_t* out, uint8_t clear);
+
+#else
+
+#define PROF_ENTER(id) do {} while (0)
+#define PROF_EXIT(id) do {} while (0)
+#define PROF_ENTER_CRITICAL_REGION() AVR_ENTER_CRITICAL_REGION()
+#define PROF_LEAVE_CRITICAL_REGION() AVR_LEAVE_CRITICAL_REGION()
+
+#endif /* PROFILE */
+
+#endif /* PROFILE_H */
@@ -0,0 +1,423 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "avr_compiler.h"
+#include "fixed.h"
+#include "pid.h"
+#include "motion.h"
+#include "path.h"
+#include "output.h"
+#include "current.h"
+#include "analog.h"
+#include "sched.h"
+#include "daughterboard.h"
+#include "i2c_commands.h"
+#include "regmap.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Layout
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    uint8_t addr;
+    uint8_t size;
+} reg_field_t;
+
+/* offsets within each channel's block */
+static const reg_field_t config_fields[] = {
+    { I2C_REG_MODE, 1 },
+    { I2C_REG_FORMAT, 1 },
+    { I2C_REG_TARGET, 4 },
+    { I2C_REG_P, 4 },
+    { I2C_REG_I, 4 },
+    { I2C_REG_D, 4 },
+    { I2C_REG_MOVE_VELOCITY, 4 },
+    { I2C_REG_MOVE_ACCELERATION, 4 },
+    { I2C_REG_MOVE_JERK, 4 },
+};
+
+static const reg_field_t status_fields[] = {
+    { I2C_REG_MEASURED, 4 },
+    { I2C_REG_DUTY, 2 },
+    { I2C_REG_DIRECTION, 1 },
+    { I2C_REG_MOTION_STATUS, 1 },
+    { I2C_REG_MOTION_LEFT, 2 },
+    { I2C_REG_PATH_STATUS, 1 },
+    { I2C_REG_PATH_FREE, 1 },
+    { I2C_REG_PATH_LEFT, 2 },
+    { I2C_REG_PATH_DRY, 2 },
+};
+
+/* and absolute addresses outside them; the overruns and analog inputs
+ * are runs of u16s */
+static const reg_field_t board_fields[] = {
+    { I2C_REG_OVERRUNS, 2 * SCHED_GROUP_COUNT },
+    { I2C_REG_ANALOG_SWEEPS, 2 },
+    { I2C_REG_ANALOG, 2 * ANALOG_CHANNELS },
+    { I2C_REG_MOVE_A, 4 },
+    { I2C_REG_MOVE_B, 4 },
+};
+
+#define FIELDS(f) (sizeof(f) / sizeof(f[0]))
+
+/* a channel's registers that change with the control tick, as they
+ * read */
+typedef struct {
+    int32_t target;
+    int32_t measured;
+    uint16_t duty;
+    uint8_t direction;
+    uint8_t motion_status;
+    uint16_t motion_left;
+    uint8_t path_status;
+    uint8_t path_free;
+    uint16_t path_left;
+    uint16_t path_dry;
+} reg_status_t;
+
+static uint8_t reg_ptr;
+static register8_t reg_latch[4];
+static uint8_t reg_latch_addr;
+static bool reg_latched;
+
+/* both channels' status, in two copies: the TWI interrupt reads
+ * reg_status_idx's and regmap_refresh() fills in the other */
+static reg_status_t reg_status[2][2];
+static volatile uint8_t reg_status_idx;
+
+/* Find the register addr falls in. Returns its size, or 0 if it's in
+ * none, and its first address through start. */
+static uint8_t reg_find(uint8_t addr, uint8_t* start)
+{
+    const reg_field_t* f = board_fields;
+    uint8_t n = FIELDS(board_fields);
+    uint8_t base = 0;
+    uint8_t i;
+
+    if (addr < I2C_REG_STATUS_A)
+    {
+        f = config_fields;
+        n = FIELDS(config_fields);
+        base = addr & ~(I2C_REG_CHANNEL_SIZE - 1);
+    }
+    else if (addr < I2C_REG_BOARD)
+    {
+        f = status_fields;
+        n = FIELDS(status_fields);
+        base = addr & ~(I2C_REG_CHANNEL_SIZE - 1);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        uint8_t off = addr - base - f[i].addr;
+        uint8_t size = f[i].size;
+
+        /* the runs of u16s are one register per u16 */
+        if (size > 4)
+        {
+            if (off >= size)
+                continue;
+            *start = addr & ~1;
+            return 2;
+        }
+        if (off < size)
+        {
+            *start = base + f[i].addr;
+            return size;
+        }
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Access
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+static motor_channel_t* reg_channel(uint8_t addr)
+{
+    return (addr & I2C_REG_CHANNEL_SIZE) ? &motB : &motA;
+}
+
+/* Copy register start into buf, from the TWI interrupt. What the
+ * control tick changes comes from the status copy, which is all from
+ * one tick and already worked out; the configuration only changes as
+ * commands are decoded, and reads wait for that. */
+static void reg_get(uint8_t start, register8_t* buf)
+{
+    motor_channel_t* mot = reg_channel(start);
+    uint8_t off = start & (I2C_REG_CHANNEL_SIZE - 1);
+    const reg_status_t* st = &reg_status[reg_status_idx][mot == &motB];
+    uint16_t overruns;
+
+    if (start < I2C_REG_STATUS_A)
+    {
+        switch (off)
+        {
+        case I2C_REG_MODE:
+            buf[0] = (mot->closed ? (1 << 6) : 0) | (mot->sensorchan & 0x0f);
+            break;
+        case I2C_REG_FORMAT:
+            buf[0] = (mot->cont.q == FIX_Q24);
+            break;
+        case I2C_REG_TARGET:
+            write_u32(buf, st->target);
+            break;
+        case I2C_REG_P:
+            write_u32(buf, mot->cont.P);
+            break;
+        case I2C_REG_I:
+            write_u32(buf, mot->cont.I);
+            break;
+        case I2C_REG_D:
+            write_u32(buf, mot->cont.D);
+            break;
+        case I2C_REG_MOVE_VELOCITY:
+            write_u32(buf, mot->motion.vmax);
+            break;
+        case I2C_REG_MOVE_ACCELERATION:
+            write_u32(buf, mot->motion.amax);
+            break;
+        case I2C_REG_MOVE_JERK:
+            write_u32(buf, mot->motion.jmax);
+            break;
+        }
+    }
+    else if (start < I2C_REG_BOARD)
+    {
+        switch (off)
+        {
+        case I2C_REG_MEASURED:
+            write_u32(buf, st->measured);
+            break;
+        case I2C_REG_DUTY:
+            write_u16(buf, st->duty);
+            break;
+        case I2C_REG_DIRECTION:
+            buf[0] = st->direction;
+            break;
+        case I2C_REG_MOTION_STATUS:
+            buf[0] = st->motion_status;
+            break;
+        case I2C_REG_MOTION_LEFT:
+            write_u16(buf, st->motion_left);
+            break;
+        case I2C_REG_PATH_STATUS:
+            buf[0] = st->path_status;
+            break;
+        case I2C_REG_PATH_FREE:
+            buf[0] = st->path_free;
+            break;
+        case I2C_REG_PATH_LEFT:
+            write_u16(buf, st->path_left);
+            break;
+        case I2C_REG_PATH_DRY:
+            write_u16(buf, st->path_dry);
+            break;
+        }
+    }
+    else if (start < I2C_REG_ANALOG_SWEEPS)
+    {
+        /* counted with interrupts off, so this can't catch one half
+         * done even when we've interrupted the tick; too small to be
+         * worth a snapshot */
+        AVR_ENTER_CRITICAL_REGION();
+        overruns = sched_groups[(start - I2C_REG_OVERRUNS) / 2].overruns;
+        AVR_LEAVE_CRITICAL_REGION();
+        write_u16(buf, overruns);
+    }
+    else if (start < I2C_REG_ANALOG)
+        write_u16(buf, analog_sweeps());
+    else if (start < I2C_REG_MOVE_A)
+        write_u16(buf, analog_read((start - I2C_REG_ANALOG) / 2));
+    else if (start == I2C_REG_MOVE_A)
+        write_u32(buf, motA.motion.request);
+    else
+        write_u32(buf, motB.motion.request);
+}
+
+/* one channel's status registers, from its latest snapshot */
+static void reg_status_channel(motor_channel_t* mot, reg_status_t* st)
+{
+    motor_snap_t snap;
+
+    motor_snapshot(mot, &snap);
+    st->target = snap.target;
+    st->measured = snap.measured;
+    st->duty = snap.drive < 0 ? -snap.drive : snap.drive;
+    st->direction = snap.drive < 0;
+    st->motion_status = motion_status(&mot->motion);
+    st->motion_left = ticks_to_ms(snap.motion_left);
+    st->path_status = path_status(&mot->path);
+    st->path_free = path_free(&mot->path);
+    st->path_left = ticks_to_ms(snap.path_left + path_buffered(&mot->path));
+    st->path_dry = snap.path_dry;
+}
+
+/* a move limit as the set move limit commands take it: a negative one
+ * is zero */
+static uint32_t reg_limit(register8_t* buf)
+{
+    int32_t value = read_u32(buf);
+
+    return value < 0 ? 0 : value;
+}
+
+/* Registers hold values the way the firmware does, integers and raw
+ * fixed point gains, where the matching commands take floats; so a
+ * value reads back just as it was written. Otherwise a write does
+ * what the matching command does. */
+static void reg_set(uint8_t start, register8_t* buf)
+{
+    motor_channel_t* mot = reg_channel(start);
+
+    if (start == I2C_REG_MOVE_A || start == I2C_REG_MOVE_B)
+    {
+        motor_move(start == I2C_REG_MOVE_A ? &motA : &motB, read_u32(buf));
+        return;
+    }
+    if (start >= I2C_REG_STATUS_A)
+        return;
+
+    switch (start & (I2C_REG_CHANNEL_SIZE - 1))
+    {
+    case I2C_REG_MODE:
+        motor_set_mode(mot, buf[0]);
+        break;
+    case I2C_REG_FORMAT:
+        pid_set_format(&mot->cont, buf[0] ? FIX_Q24 : FIX_Q16);
+        break;
+    case I2C_REG_TARGET:
+        motor_set_target(mot, read_u32(buf));
+        break;
+    case I2C_REG_P:
+        mot->cont.P = read_u32(buf);
+        mot->cont.dirty = true;
+        break;
+    case I2C_REG_I:
+        mot->cont.I = read_u32(buf);
+        mot->cont.dirty = true;
+        break;
+    case I2C_REG_D:
+        mot->cont.D = read_u32(buf);
+        mot->cont.dirty = true;
+        break;
+    case I2C_REG_MOVE_VELOCITY:
+        mot->motion.vmax = reg_limit(buf);
+        break;
+    case I2C_REG_MOVE_ACCELERATION:
+        mot->motion.amax = reg_limit(buf);
+        break;
+    case I2C_REG_MOVE_JERK:
+        mot->motion.jmax = reg_limit(buf);
+        break;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Register map
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Writes come in through the frame queue like every other command, so
+ * regmap_select() and regmap_write() run in the main loop with the
+ * control interrupts held off and a register write lands between
+ * ticks, never in the middle of one. Only regmap_read() runs in the
+ * TWI interrupt. The two share the latch, but the driver holds reads
+ * off until the frame being decoded is released, so they never
+ * overlap. */
+
+/* Work out the status registers, in the main loop: they take a
+ * snapshot, a walk of the path buffer and a division or two, which
+ * would hold the bus up in the TWI interrupt. Done with every register
+ * command, so a read straight after one is up to date, and from the
+ * supervise group, so repeated reads never see anything older than a
+ * millisecond. The interrupt can come in at any point, so the copy it
+ * isn't reading is filled in and it's only switched over once that's
+ * done. */
+void regmap_refresh(void)
+{
+    reg_status_t* next = reg_status[!reg_status_idx];
+
+    reg_status_channel(&motA, &next[0]);
+    reg_status_channel(&motB, &next[1]);
+    /* the copy has to be all there before the switch, which the
+     * compiler would otherwise be free to move the stores past */
+    __asm__ volatile("" ::: "memory");
+    reg_status_idx = !reg_status_idx;
+}
+
+void regmap_select(uint8_t addr)
+{
+    reg_ptr = addr;
+    reg_latched = false;
+    regmap_refresh();
+}
+
+void regmap_write(uint8_t data)
+{
+    uint8_t addr = reg_ptr++;
+    uint8_t start;
+    uint8_t size = reg_find(addr, &start);
+
+    if (size == 0)
+        return;
+    if (addr == start)
+    {
+        reg_latch_addr = start;
+        reg_latched = true;
+    }
+    else if (!reg_latched || reg_latch_addr != start)
+        return;                 /* came in partway through */
+
+    reg_latch[addr - start] = data;
+    if (addr - start == size - 1)
+    {
+        reg_set(start, reg_latch);
+        reg_latched = false;
+    }
+}
+
+uint8_t regmap_read(void)
+{
+    uint8_t addr = reg_ptr++;
+    uint8_t start;
+    uint8_t size = reg_find(addr, &start);
+
+    if (size == 0)
+        return 0;
+    if (addr == start || !reg_latched || reg_latch_addr != start)
+    {
+        reg_get(start, reg_latch);
+        reg_latch_addr = start;
+        reg_latched = true;
+    }
+    return reg_latch[addr - start];
+}
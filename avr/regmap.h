@@ -0,0 +1,45 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef REGMAP_H
+#define REGMAP_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* The I2C register map (see I2C_CMD_REGISTERS for the layout).
+ * regmap_select() and regmap_write() are called as register commands
+ * are decoded in the main loop, regmap_read() from the TWI interrupt
+ * as the master reads; each byte moves the register pointer on by
+ * one. Multi-byte registers go
+ * through a latch, the way the xmega's own 16-bit registers go through
+ * TEMP: a read copies the whole register when its first byte is read
+ * and a write only takes effect when its last byte arrives. The
+ * status registers are read from a copy regmap_refresh() works out in
+ * the main loop, so the interrupt only ever copies bytes. */
+
+void regmap_select(uint8_t addr);
+void regmap_write(uint8_t data);
+uint8_t regmap_read(void);
+void regmap_refresh(void);
+
+#endif /* REGMAP_H */
@@ -0,0 +1,88 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+
+#include "avr_compiler.h"
+#include "sched.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Scheduler
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+volatile uint16_t sched_ticks = 0;
+
+static void run_tasks(rategroup_t* group)
+{
+    for (uint8_t i = 0; i < SCHED_TASKS_MAX && group->tasks[i]; i++)
+        group->tasks[i]();
+}
+
+/* called from the control interrupt once per tick */
+void sched_tick(rategroup_t* group)
+{
+    sched_ticks++;
+    run_tasks(group);
+}
+
+/* the tick counter is two bytes wide and written from an interrupt, so
+ * it has to be read with interrupts off */
+uint16_t sched_now(void)
+{
+    uint16_t now;
+    AVR_ENTER_CRITICAL_REGION();
+    now = sched_ticks;
+    AVR_LEAVE_CRITICAL_REGION();
+    return now;
+}
+
+/* Called from the main loop. Runs every group whose deadline has come
+ * up. A group that finds itself a whole period late has missed a
+ * deadline; it counts an overrun and rebases rather than running
+ * several times back to back to catch up. */
+void sched_run(rategroup_t* groups, uint8_t count)
+{
+    uint16_t now = sched_now();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        rategroup_t* g = &groups[i];
+
+        if ((int16_t)(now - g->next) < 0)
+            continue;
+
+        run_tasks(g);
+
+        g->next += g->period;
+        if ((int16_t)(now - g->next) >= 0)
+        {
+            /* the TWI interrupt reads the count */
+            AVR_ENTER_CRITICAL_REGION();
+            g->overruns++;
+            AVR_LEAVE_CRITICAL_REGION();
+            g->next = now + g->period;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type and Variable Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* A rate group is a fixed list of tasks that run together every
+ * .period control ticks. The control group runs straight out of the
+ * clock 1 interrupt; every other group is run from the main loop when
+ * its deadline comes up, so a slow LED update can never delay a
+ * control tick. There is no preemption between main loop groups, they
+ * simply run in table order. */
+
+#define SCHED_TASKS_MAX 4
+
+typedef void (*taskfunc)(void);
+
+typedef struct {
+    uint16_t period;            /* in control ticks */
+    uint16_t next;              /* tick this group is next due at */
+    uint16_t overruns;          /* deadlines missed by a whole period */
+    taskfunc tasks[SCHED_TASKS_MAX]; /* unused slots are 0 */
+} rategroup_t;
+
+/* counts control ticks; only written by sched_tick() */
+extern volatile uint16_t sched_ticks;
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void sched_tick(rategroup_t* group);
+void sched_run(rategroup_t* groups, uint8_t count);
+uint16_t sched_now(void);
+
+#endif /* SCHED_H */
@@ -0,0 +1,324 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Includes
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "avr_compiler.h"
+#include "fixed.h"
+#include "pid.h"
+#include "motion.h"
+#include "path.h"
+#include "output.h"
+#include "current.h"
+#include "sched.h"
+#include "daughterboard.h"
+#include "telemetry.h"
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Recording
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+static uint16_t telem_ring[TELEM_WORDS];
+static volatile uint8_t telem_head;     /* next word the tick writes */
+static volatile uint8_t telem_tail;     /* first word not yet read */
+static uint8_t telem_mask;
+static uint8_t telem_size;              /* words per sample */
+static uint16_t telem_decimation;       /* ticks per sample, 0 is off */
+static uint16_t telem_countdown;
+static uint16_t telem_seq;
+
+/* capture */
+static uint8_t telem_state;
+static uint8_t telem_trigger;
+static int16_t telem_level;
+static uint16_t telem_last;             /* for spotting a change */
+static uint8_t telem_pre;               /* samples kept before trigger */
+static uint8_t telem_post;              /* samples left to record */
+static uint16_t telem_trig_seq;         /* sample the trigger was on */
+
+/* the read in progress, TWI interrupt only */
+static uint8_t telem_rd;                /* word being sent */
+static uint8_t telem_rd_count;          /* whole samples left to send */
+static uint8_t telem_rd_words;          /* of this sample sent */
+static uint8_t telem_rd_bytes;          /* of the reply sent, up to 2 */
+static bool telem_rd_odd;               /* low byte of the word sent */
+static bool telem_rd_capturing;         /* nothing to send yet */
+
+static uint8_t telem_used(void)
+{
+    uint8_t head = telem_head;
+    uint8_t tail = telem_tail;
+
+    return head >= tail ? head - tail : TELEM_WORDS - tail + head;
+}
+
+void telem_init(void)
+{
+    telem_config(0, 0);
+}
+
+static int16_t telem_field(uint8_t bit)
+{
+    motor_channel_t* mot = (bit & 4) ? &motB : &motA;
+
+    switch (bit & 3)
+    {
+    case 0:
+        return (int16_t)mot->cont.target;
+    case 1:
+        return (int16_t)mot->measured;
+    case 2:
+        return (int16_t)fix_clamp(mot->cont.e_cur, INT16_MIN, INT16_MAX);
+    default:
+        return (int16_t)(mot->output.drive >> 1);
+    }
+}
+
+/* the mode of both channels, as set by the mode byte */
+static uint16_t telem_modes(void)
+{
+    return ((motA.closed ? 0x10 : 0) | (motA.sensorchan & 0x0f)) |
+        ((uint16_t)((motB.closed ? 0x10 : 0) | (motB.sensorchan & 0x0f)) << 8);
+}
+
+static uint16_t telem_overruns(void)
+{
+    uint16_t sum = 0;
+
+    for (uint8_t i = 0; i < SCHED_GROUP_COUNT; i++)
+        sum += sched_groups[i].overruns;
+    return sum;
+}
+
+/* whole samples the ring holds */
+static uint8_t telem_capacity(void)
+{
+    return (TELEM_WORDS - 1) / telem_size;
+}
+
+static void telem_reset(uint8_t mask, uint16_t decimation, uint8_t state)
+{
+    uint8_t size = 1;
+
+    for (uint8_t m = mask; m; m >>= 1)
+        size += m & 1;
+
+    telem_mask = mask;
+    telem_size = size;
+    telem_decimation = decimation;
+    telem_countdown = decimation;
+    telem_seq = 0;
+    telem_head = 0;
+    telem_tail = 0;
+    telem_rd_count = 0;
+    telem_state = state;
+}
+
+/* Select the fields and start recording afresh, or stop with a
+ * decimation of 0. Called from the main loop with interrupts off. */
+void telem_config(uint8_t mask, uint16_t decimation)
+{
+    telem_reset(mask, decimation, TELEM_STREAM);
+}
+
+/* Arm a capture; pretrigger is the fraction of the ring, in 256ths,
+ * to keep from before the trigger. Called from the main loop with
+ * interrupts off. */
+void telem_capture(uint8_t mask, uint16_t decimation, uint8_t trigger,
+                   int16_t level, uint8_t pretrigger)
+{
+    telem_reset(mask, decimation ? decimation : 1, TELEM_ARMED);
+    telem_trigger = trigger;
+    telem_level = level;
+    telem_pre = ((uint16_t)telem_capacity() * pretrigger) >> 8;
+    telem_post = 0;
+    telem_trig_seq = 0;
+
+    switch (trigger & 0x0f)
+    {
+    case TELEM_TRIG_MODE:
+        telem_last = telem_modes();
+        break;
+    case TELEM_TRIG_FAULT:
+        telem_last = telem_overruns();
+        break;
+    default:
+        telem_last = (uint16_t)telem_field(trigger >> 4);
+        break;
+    }
+}
+
+/* whether this sample is the trigger */
+static bool telem_triggered(void)
+{
+    int16_t prev = (int16_t)telem_last;
+    int16_t v;
+    uint16_t now;
+
+    switch (telem_trigger & 0x0f)
+    {
+    case TELEM_TRIG_NOW:
+        return true;
+    case TELEM_TRIG_RISING:
+        v = telem_field(telem_trigger >> 4);
+        telem_last = (uint16_t)v;
+        return prev < telem_level && v >= telem_level;
+    case TELEM_TRIG_FALLING:
+        v = telem_field(telem_trigger >> 4);
+        telem_last = (uint16_t)v;
+        return prev > telem_level && v <= telem_level;
+    case TELEM_TRIG_MODE:
+        now = telem_modes();
+        break;
+    case TELEM_TRIG_FAULT:
+        now = telem_overruns();
+        break;
+    default:
+        return false;
+    }
+    if (now == telem_last)
+        return false;
+    telem_last = now;
+    return true;
+}
+
+/* Called from the control tick after the controllers have run. When
+ * streaming, a sample that doesn't fit is counted in the sequence and
+ * dropped; when capturing, the oldest sample is dropped instead. */
+void telem_sample(void)
+{
+    uint8_t h;
+
+    if (telem_decimation == 0 || telem_state == TELEM_FROZEN ||
+        --telem_countdown)
+        return;
+    telem_countdown = telem_decimation;
+
+    if (telem_state == TELEM_ARMED && telem_triggered())
+    {
+        telem_state = TELEM_TRIGGERED;
+        telem_trig_seq = telem_seq;
+        telem_post = telem_capacity() - telem_pre;
+    }
+
+    if (TELEM_WORDS - 1 - telem_used() < telem_size)
+    {
+        if (telem_state == TELEM_STREAM)
+        {
+            telem_seq++;
+            return;
+        }
+        /* nothing is read while capturing */
+        h = telem_tail + telem_size;
+        telem_tail = h >= TELEM_WORDS ? h - TELEM_WORDS : h;
+    }
+
+    h = telem_head;
+    telem_ring[h] = telem_seq++;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+        if (!(telem_mask & (1 << bit)))
+            continue;
+        if (++h == TELEM_WORDS)
+            h = 0;
+        telem_ring[h] = (uint16_t)telem_field(bit);
+    }
+    if (++h == TELEM_WORDS)
+        h = 0;
+    telem_head = h;
+
+    if (telem_state == TELEM_TRIGGERED && --telem_post == 0)
+        telem_state = TELEM_FROZEN;
+}
+
+/* Called from the main loop with interrupts off: the state, bytes per
+ * sample, samples the ring can hold and does hold, the sequence number
+ * of the trigger sample, and the ring's size in bytes, which is all
+ * the RAM recording uses. */
+void telem_status(uint8_t* buf)
+{
+    buf[0] = telem_state;
+    buf[1] = telem_size * 2;
+    buf[2] = telem_capacity();
+    buf[3] = telem_used() / telem_size;
+    write_u16(&buf[4], telem_trig_seq);
+    write_u16(&buf[6], sizeof(telem_ring));
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Readback
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Called from the main loop, with interrupts off, when a telemetry
+ * command is decoded: the reply is everything recorded so far, or
+ * nothing, flagged, while a capture is still going. */
+void telem_begin_read(void)
+{
+    uint8_t n = telem_used() / telem_size;
+
+    telem_rd_capturing = telem_state == TELEM_ARMED
+        || telem_state == TELEM_TRIGGERED;
+    if (telem_rd_capturing)
+        n = 0;
+
+    telem_rd = telem_tail;
+    telem_rd_count = n;
+    telem_rd_words = 0;
+    telem_rd_bytes = 0;
+    telem_rd_odd = false;
+}
+
+/* Called from the TWI interrupt for each byte the master reads: the
+ * sample count, with TELEM_READ_CAPTURING if a capture is going, and
+ * the bytes in each sample, then the samples, low byte of each word
+ * first, then zeros. */
+uint8_t telem_read(void)
+{
+    uint16_t w;
+
+    if (telem_rd_bytes < 2)
+        return telem_rd_bytes++ ? telem_size * 2
+            : telem_rd_count | (telem_rd_capturing ? TELEM_READ_CAPTURING : 0);
+    if (telem_rd_count == 0)
+        return 0;
+
+    w = telem_ring[telem_rd];
+    telem_rd_odd = !telem_rd_odd;
+    if (telem_rd_odd)
+        return w & 0xff;
+
+    if (++telem_rd == TELEM_WORDS)
+        telem_rd = 0;
+    if (++telem_rd_words == telem_size)
+    {
+        telem_rd_words = 0;
+        telem_rd_count--;
+        telem_tail = telem_rd;
+    }
+    return w >> 8;
+}
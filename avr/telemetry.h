@@ -0,0 +1,98 @@
+/* pcimotor - a modular motor controller */
+/* Copyright (C) 2012  Saul Reynolds-Haertle */
+
+/* This program is free software; you can redistribute it and/or */
+/* modify it under the terms of the GNU General Public License */
+/* as published by the Free Software Foundation; either version 2 */
+/* of the License, or (at your option) any later version. */
+
+/* This program is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with this program; if not, write to the Free Software */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Type Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/* Control data recorded on the board for the host to drain in bulk.
+ * Every decimation'th control tick, telem_sample() puts a sample in a
+ * ring of 16-bit words: a sequence number, then each field selected in
+ * the mask, in bit order. The sequence number counts every sample
+ * taken, including ones dropped because the ring was full, so the host
+ * can tell exactly which are missing; the tick never waits and never
+ * overwrites anything the host hasn't read.
+ *
+ * A telemetry command snapshots how many whole samples there are,
+ * from the main loop, and the read that follows is streamed straight
+ * out of the ring by the TWI interrupt. A sample is only freed once
+ * its last byte has gone out, so a read cut short sends the rest of it
+ * again next time.
+ *
+ * The same ring doubles as a capture buffer, like a scope's. Once
+ * armed, the tick records into it continuously, dropping the oldest
+ * sample when it's full, and checks the trigger on every sample. After
+ * the trigger it records enough samples to leave the chosen number of
+ * pre-trigger samples in the ring and freezes; nothing can be read
+ * until then, which a read's count says, and nothing is recorded
+ * after, until it's rearmed. */
+
+#ifndef TELEM_WORDS
+#define TELEM_WORDS 96              /* ring size, 16-bit words, < 128 */
+#endif
+
+/* set in a read's sample count while a capture is still going, so it
+ * isn't taken for an empty ring; the ring never holds 128 samples */
+#define TELEM_READ_CAPTURING 0x80
+
+/* fields, per channel: bits 0-3 channel A, 4-7 channel B */
+#define TELEM_TARGET 0x01           /* low 16 bits */
+#define TELEM_MEASURED 0x02         /* low 16 bits */
+#define TELEM_ERROR 0x04            /* saturated */
+#define TELEM_DUTY 0x08             /* signed by direction, halved */
+#define TELEM_CHANNEL_B(f) ((f) << 4)
+
+/* states, as reported by telem_status() */
+#define TELEM_STREAM 0              /* recording for readback, or off */
+#define TELEM_ARMED 1               /* capturing, waiting for trigger */
+#define TELEM_TRIGGERED 2           /* capturing after the trigger */
+#define TELEM_FROZEN 3              /* capture done, ready to read */
+
+/* capture triggers, low nibble; the high nibble is the field (bit
+ * number in the mask) a crossing is on */
+#define TELEM_TRIG_NOW 0            /* the first sample */
+#define TELEM_TRIG_RISING 1         /* field goes from below to >= level */
+#define TELEM_TRIG_FALLING 2        /* field goes from above to <= level */
+#define TELEM_TRIG_MODE 3           /* either channel's mode changes */
+#define TELEM_TRIG_FAULT 4          /* any rate group overruns */
+
+/* telem_status() reply */
+#define TELEM_STATUS_BYTES 8
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+/// Function Declarations
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+void telem_init(void);
+void telem_config(uint8_t mask, uint16_t decimation);
+void telem_capture(uint8_t mask, uint16_t decimation, uint8_t trigger,
+                   int16_t level, uint8_t pretrigger);
+void telem_sample(void);
+void telem_status(uint8_t* buf);
+void telem_begin_read(void);
+uint8_t telem_read(void);
+
+#endif /* TELEMETRY_H */
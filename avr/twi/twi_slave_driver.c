@@ -75,7 +75,7 @@
  *
  *  \param twi                  The TWI_Slave_t struct instance.
  *  \param module               Pointer to the TWI module.
- *  \param processDataFunction  Pointer to the function that handles incoming data.
+ *  \param processDataFunction  Pointer to the function that handles incoming data, or 0.
  */
 void TWI_SlaveInitializeDriver(TWI_Slave_t *twi,
                                TWI_t *module,
@@ -83,6 +83,24 @@ void TWI_SlaveInitializeDriver(TWI_Slave_t *twi,
 {
 	twi->interface = module;
 	twi->Process_Data = processDataFunction;
+	twi->Send_Data = 0;
+	twi->frameHead = 0;
+	twi->frameTail = 0;
+	twi->receivedData = 0;
+	twi->sendData = 0;
+	twi->sendLength = 0;
+	twi->stagedData = 0;
+	twi->stagedLength = 0;
+	twi->stagedCommand = 0;
+	twi->lastCommand = 0;
+	twi->readData = 0;
+	twi->readLength = 0;
+	twi->readStaged = false;
+	twi->secondAddress = 0;
+	twi->secondData = 0;
+	twi->secondLength = 0;
+	twi->spareCommand = 0;
+	twi->spare = false;
 	twi->bytesReceived = 0;
 	twi->bytesSent = 0;
 	twi->status = TWIS_STATUS_READY;
@@ -112,6 +130,83 @@ void TWI_SlaveInitializeModule(TWI_Slave_t *twi,
 }
 
 
+/*! \brief Answer the general call address as well as our own.
+ *
+ *  Writes to address 0 are received like any other; reads aren't
+ *  allowed there.
+ *
+ *  \param twi    The TWI_Slave_t struct instance.
+ *  \param enable Whether to answer it.
+ */
+void TWI_SlaveGeneralCall(TWI_Slave_t *twi, bool enable)
+{
+	if (enable)
+		twi->interface->SLAVE.ADDR |= 0x01;
+	else
+		twi->interface->SLAVE.ADDR &= ~0x01;
+}
+
+
+/*! \brief Change the slave address.
+ *
+ *  Takes effect from the next start condition. The general call
+ *  setting is kept.
+ *
+ *  \param twi     The TWI_Slave_t struct instance.
+ *  \param address New slave address.
+ */
+void TWI_SlaveAddress(TWI_Slave_t *twi, uint8_t address)
+{
+	twi->interface->SLAVE.ADDR = (address<<1) |
+	                             (twi->interface->SLAVE.ADDR & 0x01);
+}
+
+
+/*! \brief Answer reads at a second address with fixed data.
+ *
+ *  Uses the address mask register as a second address. Reads there
+ *  send data whether or not there are frames pending, and writes
+ *  there are NACKed. Several slaves can answer the same second
+ *  address at once; the ones that lose arbitration see a transmit
+ *  collision and drop out.
+ *
+ *  \param twi     The TWI_Slave_t struct instance.
+ *  \param address Second address, or 0 for none.
+ *  \param data    What to send, which must stay put.
+ *  \param length  Number of bytes in data.
+ */
+void TWI_SlaveSecondAddress(TWI_Slave_t *twi, uint8_t address,
+                            const uint8_t *data, uint8_t length)
+{
+	twi->secondAddress = 0;
+	twi->secondData = data;
+	twi->secondLength = length;
+	twi->secondAddress = address;
+	/* ADDREN makes the mask register a second address rather than a
+	 * mask; with none, clear it so nothing but ADDR matches. */
+	twi->interface->SLAVE.ADDRMASK = address ?
+	                                  (address<<1) | TWI_SLAVE_ADDREN_bm : 0;
+}
+
+
+/*! \brief Take one general call command even with no free frame.
+ *
+ *  A general call write that comes in while every frame is waiting for
+ *  the application is still ACKed if its first byte is command; that
+ *  byte goes to Process_Data as usual, but the write is never queued
+ *  and any byte after it is NACKed. Any other general call write is
+ *  NACKed at its first byte, and a write to the slave address at its
+ *  address, as before.
+ *
+ *  \param twi     The TWI_Slave_t struct instance.
+ *  \param command The command, or 0 for none.
+ */
+void TWI_SlaveSpareCommand(TWI_Slave_t *twi, uint8_t command)
+{
+	twi->spareCommand = command;
+}
+
+
 /*! \brief Common TWI slave interrupt service routine.
  *
  *  Handles all TWI transactions and responses to address match, data reception,
@@ -125,6 +220,7 @@ void TWI_SlaveInterruptHandler(TWI_Slave_t *twi)
 
 	/* If bus error. */
 	if (currentStatus & TWI_SLAVE_BUSERR_bm) {
+		TWI_SlaveReceiveDone(twi, false);
 		twi->bytesReceived = 0;
 		twi->bytesSent = 0;
 		twi->result = TWIS_RESULT_BUS_ERROR;
@@ -133,6 +229,7 @@ void TWI_SlaveInterruptHandler(TWI_Slave_t *twi)
 
 	/* If transmit collision. */
 	else if (currentStatus & TWI_SLAVE_COLL_bm) {
+		TWI_SlaveReceiveDone(twi, false);
 		twi->bytesReceived = 0;
 		twi->bytesSent = 0;
 		twi->result = TWIS_RESULT_TRANSMIT_COLLISION;
@@ -170,11 +267,51 @@ void TWI_SlaveInterruptHandler(TWI_Slave_t *twi)
  */
 void TWI_SlaveAddressMatchHandler(TWI_Slave_t *twi)
 {
+	/* The data register holds the address byte that matched. */
+	bool second = twi->secondAddress &&
+	              (twi->interface->SLAVE.DATA >> 1) == twi->secondAddress;
+	bool general = (twi->interface->SLAVE.DATA >> 1) == 0;
+	bool full;
+
+	/* A repeated start ends the write before it. */
+	TWI_SlaveReceiveDone(twi, true);
+	full = (uint8_t)(twi->frameHead - twi->frameTail) >= TWIS_RECEIVE_FRAMES;
+
 	/* If application signalling need to abort (error occured). */
 	if (twi->abort) {
 		twi->interface->SLAVE.CTRLB = TWI_SLAVE_CMD_COMPTRANS_gc;
 		TWI_SlaveTransactionFinished(twi, TWIS_RESULT_ABORTED);
 		twi->abort = false;
+	}
+	/* The second address only answers reads, from its own data. */
+	else if (second) {
+		if (twi->interface->SLAVE.STATUS & TWI_SLAVE_DIR_bm) {
+			twi->status = TWIS_STATUS_BUSY;
+			twi->result = TWIS_RESULT_UNKNOWN;
+			twi->bytesReceived = 0;
+			twi->bytesSent = 0;
+			twi->readStaged = true;
+			twi->readData = twi->secondData;
+			twi->readLength = twi->secondLength;
+			twi->interface->SLAVE.CTRLB = TWI_SLAVE_CMD_RESPONSE_gc;
+		} else {
+			twi->interface->SLAVE.CTRLB = TWI_SLAVE_ACKACT_bm |
+			                              TWI_SLAVE_CMD_COMPTRANS_gc;
+			TWI_SlaveTransactionFinished(twi, TWIS_RESULT_ABORTED);
+		}
+	}
+	/* A read after the staged command gets the staged reply, which
+	 * is ready at once. Any other read is NACKed until the
+	 * application has released every frame, since the reply depends
+	 * on them. A write is NACKed if there is no free frame to receive
+	 * it into, unless it's a general call that may be the spare
+	 * command. */
+	else if ((twi->interface->SLAVE.STATUS & TWI_SLAVE_DIR_bm) ?
+	         (twi->frameHead != twi->frameTail && !TWI_SlaveReadStaged(twi)) :
+	         (full && !(general && twi->spareCommand))) {
+		twi->interface->SLAVE.CTRLB = TWI_SLAVE_ACKACT_bm |
+		                              TWI_SLAVE_CMD_COMPTRANS_gc;
+		TWI_SlaveTransactionFinished(twi, TWIS_RESULT_ABORTED);
 	} else {
 		twi->status = TWIS_STATUS_BUSY;
 		twi->result = TWIS_RESULT_UNKNOWN;
@@ -185,6 +322,13 @@ void TWI_SlaveAddressMatchHandler(TWI_Slave_t *twi)
 
 		twi->bytesReceived = 0;
 		twi->bytesSent = 0;
+		twi->spare = !(twi->interface->SLAVE.STATUS & TWI_SLAVE_DIR_bm) && full;
+		twi->receivedData = twi->spare ? twi->spareData :
+			twi->frames[twi->frameHead & (TWIS_RECEIVE_FRAMES - 1)].data;
+		twi->readStaged = (twi->interface->SLAVE.STATUS & TWI_SLAVE_DIR_bm) &&
+		                  TWI_SlaveReadStaged(twi);
+		twi->readData = twi->readStaged ? twi->stagedData : twi->sendData;
+		twi->readLength = twi->readStaged ? twi->stagedLength : twi->sendLength;
 
 		/* Send ACK, wait for data interrupt. */
 		twi->interface->SLAVE.CTRLB = TWI_SLAVE_CMD_RESPONSE_gc;
@@ -239,14 +383,18 @@ void TWI_SlaveReadHandler(TWI_Slave_t *twi)
 	uint8_t currentCtrlA = twi->interface->SLAVE.CTRLA;
 	twi->interface->SLAVE.CTRLA = currentCtrlA | TWI_SLAVE_PIEN_bm;
 
-	/* If free space in buffer. */
-	if (twi->bytesReceived < TWIS_RECEIVE_BUFFER_SIZE) {
+	uint8_t data = twi->interface->SLAVE.DATA;
+
+	/* If free space in buffer. Without a frame, only the spare
+	 * command's one byte. */
+	if (twi->spare ? twi->bytesReceived == 0 && data == twi->spareCommand :
+	                 twi->bytesReceived < TWIS_RECEIVE_BUFFER_SIZE) {
 		/* Fetch data */
-		uint8_t data = twi->interface->SLAVE.DATA;
 		twi->receivedData[twi->bytesReceived] = data;
 
 		/* Process data. */
-		twi->Process_Data();
+		if (twi->Process_Data)
+			twi->Process_Data();
 
 		twi->bytesReceived++;
 
@@ -290,8 +438,16 @@ void TWI_SlaveWriteHandler(TWI_Slave_t *twi)
 	}
 	/* If ACK, master expects more data. */
 	else {
-		if (twi->bytesSent < TWIS_SEND_BUFFER_SIZE) {
-			uint8_t data = twi->sendData[twi->bytesSent];
+		/* If the application supplies the data, there's no end to it. */
+		if (twi->Send_Data && !twi->readStaged) {
+			twi->interface->SLAVE.DATA = twi->Send_Data();
+			twi->bytesSent++;
+
+			/* Send data, wait for data interrupt. */
+			twi->interface->SLAVE.CTRLB = TWI_SLAVE_CMD_RESPONSE_gc;
+		}
+		else if (twi->bytesSent < twi->readLength) {
+			uint8_t data = twi->readData[twi->bytesSent];
 			twi->interface->SLAVE.DATA = data;
 			twi->bytesSent++;
 
@@ -316,6 +472,121 @@ void TWI_SlaveWriteHandler(TWI_Slave_t *twi)
  */
 void TWI_SlaveTransactionFinished(TWI_Slave_t *twi, uint8_t result)
 {
+	TWI_SlaveReceiveDone(twi, result == TWIS_RESULT_OK);
 	twi->result = result;
 	twi->status = TWIS_STATUS_READY;
+	twi->readStaged = false;
+}
+
+
+/*! \brief Whether a read now would get the staged reply.
+ *
+ *  \param twi The TWI_Slave_t struct instance.
+ */
+bool TWI_SlaveReadStaged(TWI_Slave_t *twi)
+{
+	return twi->stagedData && twi->lastCommand == twi->stagedCommand;
+}
+
+
+/*! \brief Queue a master write for the application.
+ *
+ *  Only once per write, and only if any data was received. An incomplete
+ *  write is dropped and its frame reused.
+ *
+ *  \param twi The TWI_Slave_t struct instance.
+ *  \param ok  Whether the write completed.
+ */
+void TWI_SlaveReceiveDone(TWI_Slave_t *twi, bool ok)
+{
+	if (twi->bytesReceived == 0)
+		return;
+	if (ok && !twi->spare) {
+		TWIS_Frame_t *frame =
+			&twi->frames[twi->frameHead & (TWIS_RECEIVE_FRAMES - 1)];
+		frame->length = twi->bytesReceived;
+		twi->lastCommand = frame->data[0];
+		twi->frameHead++;
+	}
+	twi->bytesReceived = 0;
+}
+
+
+/*! \brief Oldest received write the application hasn't released.
+ *
+ *  The frame is the driver's own buffer; it stays valid until
+ *  TWI_SlaveFrameRelease().
+ *
+ *  \param twi The TWI_Slave_t struct instance.
+ *
+ *  \retval The frame, or 0 if there is none.
+ */
+TWIS_Frame_t *TWI_SlaveFrame(TWI_Slave_t *twi)
+{
+	if (twi->frameTail == twi->frameHead)
+		return 0;
+	return &twi->frames[twi->frameTail & (TWIS_RECEIVE_FRAMES - 1)];
+}
+
+
+/*! \brief Hand the oldest frame back to the driver.
+ *
+ *  \param twi The TWI_Slave_t struct instance.
+ */
+void TWI_SlaveFrameRelease(TWI_Slave_t *twi)
+{
+	if (twi->frameTail != twi->frameHead)
+		twi->frameTail++;
+}
+
+
+/*! \brief Set the data sent to the next master read.
+ *
+ *  The buffer is sent in place, so it mustn't change until another one
+ *  is published. Call with the TWI interrupt disabled, or before
+ *  releasing a frame: until then the reads that would send it are
+ *  refused.
+ *
+ *  \param twi    The TWI_Slave_t struct instance.
+ *  \param data   Data to send.
+ *  \param length Number of bytes in data.
+ */
+void TWI_SlavePublish(TWI_Slave_t *twi, const uint8_t *data, uint8_t length)
+{
+	twi->sendData = data;
+	twi->sendLength = length;
+}
+
+
+/*! \brief Set a reply that's ready before its command is decoded.
+ *
+ *  A read that follows a write starting with command, even by a
+ *  repeated start in the same transaction, sends this instead of
+ *  waiting for the application. The buffer is sent in place; use
+ *  TWI_SlaveSending() to find out when it's free to change again. Call
+ *  with the TWI interrupt disabled.
+ *
+ *  \param twi     The TWI_Slave_t struct instance.
+ *  \param data    Data to send.
+ *  \param length  Number of bytes in data.
+ *  \param command First byte of the writes this answers.
+ */
+void TWI_SlaveStage(TWI_Slave_t *twi, const uint8_t *data, uint8_t length,
+                    uint8_t command)
+{
+	twi->stagedData = data;
+	twi->stagedLength = length;
+	twi->stagedCommand = command;
+}
+
+
+/*! \brief Whether a read in progress is sending from a staged buffer.
+ *
+ *  \param twi  The TWI_Slave_t struct instance.
+ *  \param data The buffer.
+ */
+bool TWI_SlaveSending(TWI_Slave_t *twi, const uint8_t *data)
+{
+	return twi->readStaged && twi->status == TWIS_STATUS_BUSY &&
+	       twi->readData == data;
 }
@@ -77,9 +77,25 @@ typedef enum TWIS_RESULT_enum {
 	TWIS_RESULT_ABORTED            = (0x06<<0),
 } TWIS_RESULT_t;
 
-/* Buffer size defines. */
+/* Buffer size defines, overridable from the build. Each master write
+ * goes into one of TWIS_RECEIVE_FRAMES receive buffers (a power of two)
+ * and stays there until the application releases it. */
+#ifndef TWIS_RECEIVE_BUFFER_SIZE
 #define TWIS_RECEIVE_BUFFER_SIZE         8
+#endif
+#ifndef TWIS_SEND_BUFFER_SIZE
 #define TWIS_SEND_BUFFER_SIZE            8
+#endif
+#ifndef TWIS_RECEIVE_FRAMES
+#define TWIS_RECEIVE_FRAMES              1
+#endif
+
+
+/*! \brief A received master write. */
+typedef struct TWIS_Frame {
+	uint8_t length;                                 /*!< Number of bytes received*/
+	register8_t data[TWIS_RECEIVE_BUFFER_SIZE];     /*!< Received data*/
+} TWIS_Frame_t;
 
 
 
@@ -90,9 +106,27 @@ typedef enum TWIS_RESULT_enum {
  */
 typedef struct TWI_Slave {
 	TWI_t *interface;                               /*!< Pointer to what interface to use*/
-	void (*Process_Data) (void);                    /*!< Pointer to process data function*/
-	register8_t receivedData[TWIS_RECEIVE_BUFFER_SIZE]; /*!< Read data*/
-	register8_t sendData[TWIS_SEND_BUFFER_SIZE];        /*!< Data to write*/
+	void (*Process_Data) (void);                    /*!< Called for each byte received, if set*/
+	uint8_t (*Send_Data) (void);                    /*!< Supplies each byte sent instead of sendData, if set*/
+	TWIS_Frame_t frames[TWIS_RECEIVE_FRAMES];       /*!< Received writes, oldest at frameTail*/
+	volatile uint8_t frameHead;                     /*!< Frames received*/
+	volatile uint8_t frameTail;                     /*!< Frames released*/
+	register8_t *receivedData;                      /*!< Frame being received, or 0*/
+	const uint8_t *sendData;                        /*!< Data to write, published by the application*/
+	uint8_t sendLength;                             /*!< Number of bytes in sendData*/
+	const uint8_t *stagedData;                      /*!< Reply to stagedCommand, ready before it's decoded*/
+	uint8_t stagedLength;                           /*!< Number of bytes in stagedData*/
+	uint8_t stagedCommand;                          /*!< First byte of writes stagedData answers*/
+	uint8_t lastCommand;                            /*!< First byte of the last write received*/
+	const uint8_t *readData;                        /*!< What the read in progress sends from*/
+	uint8_t readLength;                             /*!< Number of bytes in readData*/
+	bool readStaged;                                /*!< The read in progress sends readData, not Send_Data*/
+	uint8_t secondAddress;                          /*!< Second address answered for reads, or 0*/
+	const uint8_t *secondData;                      /*!< What reads at secondAddress send*/
+	uint8_t secondLength;                           /*!< Number of bytes in secondData*/
+	uint8_t spareCommand;                           /*!< General call taken with no free frame, or 0*/
+	register8_t spareData[1];                       /*!< Receives it when there's no free frame*/
+	bool spare;                                     /*!< The write in progress is into spareData*/
 	register8_t bytesReceived;                          /*!< Number of bytes received*/
 	register8_t bytesSent;                              /*!< Number of bytes sent*/
 	register8_t status;                                 /*!< Status of transaction*/
@@ -110,6 +144,12 @@ void TWI_SlaveInitializeModule(TWI_Slave_t *twi,
                                uint8_t address,
                                TWI_SLAVE_INTLVL_t intLevel);
 
+void TWI_SlaveGeneralCall(TWI_Slave_t *twi, bool enable);
+void TWI_SlaveAddress(TWI_Slave_t *twi, uint8_t address);
+void TWI_SlaveSecondAddress(TWI_Slave_t *twi, uint8_t address,
+                            const uint8_t *data, uint8_t length);
+void TWI_SlaveSpareCommand(TWI_Slave_t *twi, uint8_t command);
+
 void TWI_SlaveInterruptHandler(TWI_Slave_t *twi);
 void TWI_SlaveAddressMatchHandler(TWI_Slave_t *twi);
 void TWI_SlaveStopHandler(TWI_Slave_t *twi);
@@ -117,6 +157,15 @@ void TWI_SlaveDataHandler(TWI_Slave_t *twi);
 void TWI_SlaveReadHandler(TWI_Slave_t *twi);
 void TWI_SlaveWriteHandler(TWI_Slave_t *twi);
 void TWI_SlaveTransactionFinished(TWI_Slave_t *twi, uint8_t result);
+void TWI_SlaveReceiveDone(TWI_Slave_t *twi, bool ok);
+bool TWI_SlaveReadStaged(TWI_Slave_t *twi);
+
+TWIS_Frame_t *TWI_SlaveFrame(TWI_Slave_t *twi);
+void TWI_SlaveFrameRelease(TWI_Slave_t *twi);
+void TWI_SlavePublish(TWI_Slave_t *twi, const uint8_t *data, uint8_t length);
+void TWI_SlaveStage(TWI_Slave_t *twi, const uint8_t *data, uint8_t length,
+                    uint8_t command);
+bool TWI_SlaveSending(TWI_Slave_t *twi, const uint8_t *data);
 
 
 /*! TWI slave interrupt service routine.